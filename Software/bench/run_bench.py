@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+"""
+RUN_BENCH.PY: cycle counts & flash/RAM sizes of the firmware, compared with bench/baseline.json
+
+  $ python bench/run_bench.py             # build, simulate, compare (exit code 1 on regression)
+  $ python bench/run_bench.py --update    # same, then store the results as new baseline
+  $ python bench/run_bench.py --no-size   # cycle counts only
+
+Without a baseline for a section (cycles or sizes) the run fails (exit code 2) unless --update
+is given, so a missing baseline never passes as "no regression".
+
+Cycles: PlatformIO [env:bench] (src/bench.cpp) runs under simavr, which prints the
+"BM_<name> <cycles>" lines of the firmware's serial output. The simulation is cycle exact, so
+every increase is reported (--tolerance allows some percent).
+Sizes: the ATmega168 firmware with the config.h defaults and the [env:size_*] option
+combinations of platformio.ini, a combination not fitting into 16kB/1kB is reported as such.
+Needs pio (PlatformIO Core) in PATH, simavr gets installed by PlatformIO (tool-simavr) or is
+taken from PATH.
+"""
+
+import argparse
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+
+PROJECT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+BASELINE = os.path.join(PROJECT, "bench", "baseline.json")
+BENCH_ENV = "bench"
+BENCH_MCU = "atmega328p"
+BENCH_FREQ = "16000000"
+SIZE_ENVS = ["ATmega168", "size_serial", "size_probes", "size_modulation", "size_envelope",
+             "size_burst", "size_counter", "size_flatness", "size_channels"]
+TIMEOUT = 120  # s, the firmware halts itself after the last benchmark
+
+RE_RESULT = re.compile(r"BM_(\w+) (\d+)")
+RE_SIZE = re.compile(r"(RAM|Flash):.*\(used (\d+) bytes from (\d+) bytes\)")
+RE_ESCAPE = re.compile(r"\x1b\[[0-9;]*m")
+
+
+def pio(*args):
+    return subprocess.run(["pio"] + list(args), cwd=PROJECT, stdout=subprocess.PIPE,
+                          stderr=subprocess.STDOUT, universal_newlines=True)
+
+
+def simavr_path():
+    home = os.environ.get("PLATFORMIO_CORE_DIR", os.path.join(os.path.expanduser("~"), ".platformio"))
+    path = os.path.join(home, "packages", "tool-simavr", "bin", "simavr")
+    if os.path.exists(path):
+        return path
+    path = shutil.which("simavr")
+    if not path:
+        sys.exit("simavr not found (neither tool-simavr of PlatformIO nor in PATH)")
+    return path
+
+
+def run_cycles():
+    build = pio("run", "-e", BENCH_ENV)
+    if build.returncode:
+        sys.exit(build.stdout + "\nbuild of [env:%s] failed" % BENCH_ENV)
+    elf = os.path.join(PROJECT, ".pio", "build", BENCH_ENV, "firmware.elf")
+    run = subprocess.run([simavr_path(), "-m", BENCH_MCU, "-f", BENCH_FREQ, elf],
+                         stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                         universal_newlines=True, timeout=TIMEOUT)
+    output = RE_ESCAPE.sub("", run.stdout)
+    if "BM_END" not in output:
+        sys.exit(output + "\nbenchmark firmware didn't finish")
+    return {name: int(cycles) for name, cycles in RE_RESULT.findall(output) if name != "END"}
+
+
+def run_sizes():
+    sizes = {}
+    for env in SIZE_ENVS:
+        build = pio("run", "-e", env)
+        used = {kind.lower(): int(count) for kind, count, _ in RE_SIZE.findall(build.stdout)}
+        if build.returncode and "flash" not in used:
+            sys.exit(build.stdout + "\nbuild of [env:%s] failed" % env)
+        used["fits"] = not build.returncode
+        sizes[env] = used
+    return sizes
+
+
+def compare(kind, new, old, tolerance):
+    regressions = 0
+    if not old:
+        print("%-5s NO BASELINE: nothing compared, store one with --update" % kind)
+    for name in sorted(new):
+        value = new[name]
+        if name not in old:
+            print("%-5s %-28s %8d  (no baseline)" % (kind, name, value))
+            continue
+        change = 100.0 * (value - old[name]) / old[name] if old[name] else 0.0
+        flag = ""
+        if value > old[name] and change > tolerance:
+            flag = "  REGRESSION"
+            regressions += 1
+        print("%-5s %-28s %8d  %+7.2f%% (was %d)%s" % (kind, name, value, change, old[name], flag))
+    for name in sorted(set(old) - set(new)):
+        print("%-5s %-28s  missing (was %d)" % (kind, name, old[name]))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description="cycle counts & sizes against bench/baseline.json")
+    parser.add_argument("--update", action="store_true", help="store the results as new baseline")
+    parser.add_argument("--no-size", action="store_true", help="skip the flash/RAM builds")
+    parser.add_argument("--tolerance", type=float, default=0.0, help="allowed increase in percent")
+    args = parser.parse_args()
+
+    try:
+        with open(BASELINE) as f:
+            baseline = json.load(f)
+    except FileNotFoundError:
+        baseline = {}
+    result = {"cycles": run_cycles(), "size": baseline.get("size", {})}
+    regressions = compare("cycle", result["cycles"], baseline.get("cycles", {}), args.tolerance)
+    if not args.no_size:
+        result["size"] = run_sizes()
+        for env, used in sorted(result["size"].items()):
+            if not used["fits"]:
+                print("size  %-28s  doesn't fit into the ATmega168" % env)
+        flat = lambda sizes: {"%s.%s" % (env, kind): count for env, used in sizes.items()
+                              for kind, count in used.items() if kind != "fits"}
+        regressions += compare("size", flat(result["size"]), flat(baseline.get("size", {})),
+                               args.tolerance)
+    missing = [kind for kind in ("cycles", "size") if not baseline.get(kind)
+               and not (kind == "size" and args.no_size)]
+    if args.update:
+        with open(BASELINE, "w") as f:
+            json.dump(result, f, indent=2, sort_keys=True)
+            f.write("\n")
+        print("baseline updated")
+        return 0
+    if missing:
+        print("FAILED: %s has no baseline in %s" % (" & ".join(missing), BASELINE))
+        return 2
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
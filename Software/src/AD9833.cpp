@@ -1,57 +1,86 @@
 /*
  * AD9833.CPP: Routines to communicate with DDS-Chip AD9833 using SPI
+ *
+ * With DDS_CHANNELS > 1 several AD9833 modules share SCLK/SDATA, each with its own FSYNC.
+ * All functions write to the selected channels (DDSChannelSelect(), all after DDSInit()) at
+ * once: their FSYNC lines go low together, so every word gets latched by all of them on the
+ * same SCLK edge (no inter-channel skew). Channels selected together share one control word,
+ * the control word of every channel is kept as shadow while it is not selected.
 */
 
-#include <Arduino.h>
-#include <SPI.h>
+#include "config.h"
+#include "hal.h"
 #include "ad9833.h"
+#include "external.h"
 
-#define AD9833_CS  PIN_SPI_SS
-#define AD9833_SPI SPISettings(4000000, MSBFIRST, SPI_MODE2)
-// AD9833 master clock (depends on module hardware)
-#define AD9833_MCLK 25000000
+#if DDS_HZ != 100
+#error "DDSFreqWord() needs frequencies in 1/100 Hz"
+#endif
+#if DDS_CHANNELS > 4
+#error "max. 4 AD9833 channels (FSYNC at PB2, PC2, PC3, PD6)"
+#endif
 
-uint16_t value = 0;
-double   konst = 268435456;       //2^28 (1 << 28) 
-float    konst2 = 4096;           // 2^12 (1 << 12)
+#define AD9833_SPI_CLOCK 4000000   // Hz
 
-// writing a 16bit word into AD9833, high byte first
-static void DDSWrite(uint16_t data)
+uint16_t value = 0;                     // control word of the selected channels
+static uint32_t mclk = AD9833_MCLK;     // calibrated master clock (Hz)
+
+#if DDS_CHANNELS > 1
+static uint8_t  ddsSelected = DDS_ALL;  // bit n...channel n
+static uint16_t ddsShadow[DDS_CHANNELS];
+#define DDS_SELECTED ddsSelected
+#else
+#define DDS_SELECTED 1
+#endif
+
+// writing a sequence of 16bit words into AD9833 within one SPI transaction, high byte first
+// (FSYNC is only toggled at word boundaries, the AD9833 latches each word on FSYNC going high)
+void DDSWriteBurst(const uint16_t *data, uint8_t count)
 {
-  SPI.beginTransaction(AD9833_SPI);
-  digitalWrite(AD9833_CS, LOW);   // set select signal LOW for AD9833
-  SPI.transfer((uint8_t)(data >> 8));
-  SPI.transfer((uint8_t)(data & 255));
-  digitalWrite(AD9833_CS, HIGH);  // set select signal HIGH for AD9833
-  SPI.endTransaction();  
+  HALSpiBegin(AD9833_SPI_CLOCK);
+  while (count--) {
+    HALDdsSelect(DDS_SELECTED);         // set select signal LOW for AD9833
+    HALSpiWrite16(*data);
+    HALDdsDeselect(DDS_SELECTED);       // set select signal HIGH for AD9833
+    data++;
+  }
+  HALSpiEnd();
 }
 
 // init AD9833
 void DDSInit(void)
 {
-  SPI.begin();
+  uint16_t burst[2] = { PHASE_ADDR, PHASE_ADDR | (1 << 13) };
+
+  HALSpiInit();
+  HALDdsInit(DDS_ALL);
+#if DDS_CHANNELS > 1
+  ddsSelected = DDS_ALL;
+#endif
   DDSOff();
+  DDSWriteBurst(burst, 2);      // PHASE0 = PHASE1 = 0 (undefined after power on)
 }
 
 // reset counter & switch off AD9833
 void DDSOff(void)
 {
+  uint16_t burst[2];
+
   // complete word write, counter reset, MCLK off, DAC disconnected, SINROM bypass
-  value = (1 << B28) | (1 << RESET) | (1 << SLEEP1) | (1 << OPBITEN) | (1 << MODE);
-  DDSWrite(value);
-  value &= ~(1 << RESET);
-  delay(1);
-  DDSWrite(value);
+  // (FSELECT cleared, FREQ0 is active register again)
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    value = (1 << B28) | (1 << RESET) | (1 << SLEEP1) | (1 << OPBITEN) | (1 << MODE);
+    burst[0] = value;
+    value &= ~(1 << RESET);
+    burst[1] = value;
+    DDSWriteBurst(burst, 2);
+  }
 }
 
-// sets output waveform (SINUS, TRIANGLE, SQUARE, SQUARE2, OFF)
-void DDSSignal (uint8_t signal) 
+// updates control word for output waveform (SINUS, TRIANGLE, SQUARE, SQUARE2)
+static void DDSControl(uint8_t signal)
 {
   switch (signal) {
-    case DDS_OFF:
-      // AD9833 no output
-      DDSOff();
-      break;
     case SINUS:
       // AD9833 output SINUS
       value &= ~((1 << OPBITEN) | (1 << MODE) | (1 << SLEEP1));
@@ -75,22 +104,285 @@ void DDSSignal (uint8_t signal)
       // no change
       break;
   }
+}
+
+// sets output waveform (SINUS, TRIANGLE, SQUARE, SQUARE2, OFF)
+void DDSSignal (uint8_t signal) 
+{
+  if (signal == DDS_OFF) {
+    // AD9833 no output
+    DDSOff();
+  }
+  else {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      DDSControl(signal);
+      DDSWriteBurst(&value, 1);
+    }
+  }
+}
+
+// converts frequency (1/100 Hz) into 28bit register value: round(frequenz * 2^28 / (100 * MCLK))
+// = round(frequenz * 2^26 / (25 * MCLK)) (integer only binary long division, no float library
+// needed, exact for all frequencies, the calibrated MCLK costs nothing extra)
+uint32_t DDSFreqWord(uint32_t frequenz)
+{
+  uint32_t divisor = mclk * (DDS_HZ / 4), rem = frequenz, regist = 0;
 
-  DDSWrite(value);
+  if (rem >= divisor) rem = divisor - 1;
+  // rem < 25 * MCLK < 2^30 always, therefore (rem << 1) never overflows
+  for (uint8_t i = 0; i < 26; i++) {
+    rem <<= 1;
+    regist <<= 1;
+    if (rem >= divisor) {
+      rem -= divisor;
+      regist |= 1;
+    }
+  }
+  // round to nearest instead of truncating
+  if ((rem << 1) >= divisor) regist++;
+  return regist;
 }
 
-// sets selected frequency by writing to register FREQ0
+// frequency (1/100 Hz) actually synthesized for frequenz: round(register value * 25 * MCLK / 2^26),
+// shift and add from the LSB (acc < 2 * 25 * MCLK < 2^31), the bits shifted out are collected
+// in frac, so the result is rounded exactly like DDSFreqWord()
+uint32_t DDSFreqActual(uint32_t frequenz)
+{
+  uint32_t regist = DDSFreqWord(frequenz), divisor = mclk * (DDS_HZ / 4), acc = 0, frac = 0;
+
+  for (uint8_t i = 0; i < 26; i++) {
+    if (regist & 1) acc += divisor;
+    regist >>= 1;
+    frac = (frac >> 1) | (acc << 31);
+    acc >>= 1;
+  }
+  // frac holds the 26 fraction bits left aligned, its MSB is the 1/2 bit
+  if (frac & 0x80000000UL) acc++;
+  return acc;
+}
+
+// loads 28bit register value as LSB/MSB words into the currently idle register FREQ0/FREQ1
+// and toggles FSELECT in the control word, which must be written last to activate it
+// (ping-pong: the active register never holds a half updated value, so retuning
+// is atomic & phase continuous with a switch latency of one word)
+static void DDSFreqLoad(uint32_t regist, uint16_t *burst)
+{
+  uint16_t addr = (value & (1 << FSELECT)) ? FREQ0_ADDR : FREQ1_ADDR;
+
+  burst[0] = (regist & 0x3FFF) | addr;
+  burst[1] = ((regist >> 14) & 0x3FFF) | addr;
+  value ^= (1 << FSELECT);
+}
+
+// sets 28bit register value by writing to the idle register FREQ0/FREQ1 and switching over
+// (the control word may also get changed from ISRs, e.g. sweep, hence the atomic block)
+void DDSFreqRaw(uint32_t regist)
+{
+  uint16_t burst[3];
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    DDSFreqLoad(regist, burst);
+    burst[2] = value;
+    DDSWriteBurst(burst, 3);
+#ifdef USE_FLATNESS
+    EXTDacRetune(regist);               // output level correction for new frequency
+#endif
+  }
+}
+
+// sets selected frequency (1/100 Hz)
 void DDSFreq(uint32_t frequenz) 
 {
-  double temp = ((double)frequenz/(double)AD9833_MCLK);
-  uint32_t regist = temp * konst;
-  uint16_t write = regist & 0x3FFF;
-  
-  write |= (1 << 14); // (0x4000)
-  DDSWrite(write);
+  DDSFreqRaw(DDSFreqWord(frequenz));
+}
+
+// writes frequency (1/100 Hz) directly into register FREQ0 or FREQ1 (e.g. FSK, active register unchanged)
+void DDSFreqReg(uint8_t reg, uint32_t frequenz)
+{
+  uint32_t regist = DDSFreqWord(frequenz);
+  uint16_t addr = reg ? FREQ1_ADDR : FREQ0_ADDR;
+  uint16_t burst[2] = { (uint16_t)((regist & 0x3FFF) | addr), (uint16_t)(((regist >> 14) & 0x3FFF) | addr) };
+
+  DDSWriteBurst(burst, 2);
+}
+
+// sets frequency & waveform together (FREQx LSB, FREQx MSB, control word in one burst)
+void DDSSetup(uint8_t signal, uint32_t frequenz)
+{
+  uint16_t burst[3];
+
+  if (signal == DDS_OFF) {
+    DDSOff();
+    return;
+  }
+  uint32_t regist = DDSFreqWord(frequenz);
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    DDSFreqLoad(regist, burst);
+    DDSControl(signal);
+    burst[2] = value;
+    DDSWriteBurst(burst, 3);
+#ifdef USE_FLATNESS
+    EXTDacRetune(regist);               // output level correction for new frequency
+#endif
+  }
+}
+
+// converts phase (degrees) into 12bit register value: round(degrees * 2^12 / 360)
+uint16_t DDSPhaseWord(uint16_t degrees)
+{
+  return (uint16_t)((((uint32_t)(degrees % 360) << 12) + 180) / 360) & 0x0FFF;
+}
+
+// writes phase offset (degrees) into register PHASE0 or PHASE1 (accumulator keeps running)
+void DDSPhase(uint8_t reg, uint16_t degrees)
+{
+  uint16_t write = PHASE_ADDR | (reg ? (1 << 13) : 0) | DDSPhaseWord(degrees);
+
+  DDSWriteBurst(&write, 1);
+}
+
+// selects active phase register PHASE0 or PHASE1
+void DDSPhaseSelect(uint8_t reg)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (reg) value |= (1 << PSELECT);
+    else value &= ~(1 << PSELECT);
+    DDSWriteBurst(&value, 1);
+  }
+}
+
+// sets frequency & phase together: both get loaded into the idle FREQx/PHASEx registers
+// and one control word switches FSELECT & PSELECT at once (4 words in one burst)
+void DDSFreqPhase(uint32_t frequenz, uint16_t degrees)
+{
+  uint16_t burst[4];
+  uint32_t regist = DDSFreqWord(frequenz);
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    DDSFreqLoad(regist, burst);
+    burst[2] = PHASE_ADDR | ((value & (1 << PSELECT)) ? 0 : (1 << 13)) | DDSPhaseWord(degrees);
+    value ^= (1 << PSELECT);
+    burst[3] = value;
+    DDSWriteBurst(burst, 4);
+  }
+}
+
+// returns actual control word (e.g. as base for precomputed modulation control words)
+uint16_t DDSControlGet(void)
+{
+  return value;
+}
+
+// writes complete control word, e.g. to get back in sync after modulation
+void DDSControlSet(uint16_t control)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    value = control;
+    DDSWriteBurst(&value, 1);
+  }
+}
 
-  write = (regist & ~0x3FFF) >> 14;
-  write |= (1 << 14); // (0x4000)
-  DDSWrite(write);
+// sets calibrated master clock (Hz) within AD9833_MCLK +/- AD9833_MCLK_TOL, used from next
+// frequency setting on
+void DDSClockSet(uint32_t clk)
+{
+  if (clk >= AD9833_MCLK - AD9833_MCLK_TOL && clk <= AD9833_MCLK + AD9833_MCLK_TOL) mclk = clk;
 }
 
+uint32_t DDSClockGet(void)
+{
+  return mclk;
+}
+
+// master clock from output frequency (set with actual MCLK) measured as edges within 16.000s:
+// round(edges * 2^28 / (16 * register value)), binary long division (56bit numerator),
+// returns 0 if the register value is 0 or the result doesn't fit into 32bit
+uint32_t DDSClockMeasured(uint32_t frequenz, uint32_t edges)
+{
+  uint32_t regist = DDSFreqWord(frequenz), rem = 0, clk = 0;
+
+  if (!regist) return 0;
+  // rem < regist < 2^28, therefore (rem << 1) never overflows
+  for (uint8_t i = 0; i < 56; i++) {
+    rem <<= 1;
+    if (i < 32) rem |= (edges >> (31 - i)) & 1;
+    if (clk & 0x80000000UL) return 0;
+    clk <<= 1;
+    if (rem >= regist) {
+      rem -= regist;
+      clk |= 1;
+    }
+  }
+  if ((rem << 1) >= regist) clk++;
+  return clk;
+}
+
+#if DDS_CHANNELS > 1
+// selects the channels (bit n...channel n) written by all following calls, the actual control
+// word is kept as shadow of the channels selected so far, the new ones continue with the
+// control word of the lowest of them: it gets written into every channel with another one, so
+// FSELECT/PSELECT agree and the next ping-pong DDSFreq() hits the inactive register of all
+void DDSChannelSelect(uint8_t channels)
+{
+  uint8_t differ = 0;
+
+  channels &= DDS_ALL;
+  if (!channels) return;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    for (uint8_t ch = 0; ch < DDS_CHANNELS; ch++) {
+      if (ddsSelected & (1 << ch)) ddsShadow[ch] = value;
+    }
+    ddsSelected = channels;
+    for (uint8_t ch = DDS_CHANNELS; ch--; ) {
+      if (channels & (1 << ch)) value = ddsShadow[ch];
+    }
+    for (uint8_t ch = 0; ch < DDS_CHANNELS; ch++) {
+      if ((channels & (1 << ch)) && ddsShadow[ch] != value) differ |= (1 << ch);
+    }
+    if (differ) {
+      HALSpiBegin(AD9833_SPI_CLOCK);
+      HALDdsSelect(differ);
+      HALSpiWrite16(value);
+      HALDdsDeselect(differ);
+      HALSpiEnd();
+    }
+  }
+}
+
+uint8_t DDSChannelSelected(void)
+{
+  return ddsSelected;
+}
+
+// writes data[n] into channel n of the selected ones, back to back within one SPI transaction
+static void DDSWriteChannels(const uint16_t *data)
+{
+  HALSpiBegin(AD9833_SPI_CLOCK);
+  for (uint8_t ch = 0; ch < DDS_CHANNELS; ch++) {
+    if (!(ddsSelected & (1 << ch))) continue;
+    HALDdsSelect(1 << ch);
+    HALSpiWrite16(data[ch]);
+    HALDdsDeselect(1 << ch);
+  }
+  HALSpiEnd();
+}
+
+// phase coherent (re)start of the selected channels: accumulators held in reset, phase offset
+// degrees[n] (channel n) written into the active PHASEx register, then all channels released
+// by one control word on the same SCLK edge (needs a common MCLK for all modules), so the
+// release skew is zero by construction, the per-channel words don't reach the outputs
+void DDSSync(const uint16_t *degrees)
+{
+  uint16_t burst[DDS_CHANNELS];
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    uint16_t addr = PHASE_ADDR | ((value & (1 << PSELECT)) ? (1 << 13) : 0);
+    uint16_t control = value | (1 << RESET);
+
+    DDSWriteBurst(&control, 1);
+    for (uint8_t ch = 0; ch < DDS_CHANNELS; ch++) burst[ch] = addr | DDSPhaseWord(degrees[ch]);
+    DDSWriteChannels(burst);
+    DDSWriteBurst(&value, 1);
+  }
+}
+#endif
@@ -14,6 +14,26 @@
 #define FREQ0     18
 #define FREQ1     28
 
+// AD9833 master clock (depends on module hardware), nominal value, calibration may correct it
+#define AD9833_MCLK 25000000UL
+#define AD9833_MCLK_TOL (AD9833_MCLK / 1000)   // max. correction +/-1000ppm
+
+// number of AD9833 modules on the SPI bus (FSYNC at PB2, PC2, PC3, PD6), see config.h
+#ifndef DDS_CHANNELS
+#define DDS_CHANNELS 1
+#endif
+#define DDS_ALL ((1 << DDS_CHANNELS) - 1)   // mask of all channels
+
+// unit of all frequencies passed to the DDS functions: 1/100 Hz (resolution MCLK/2^28 = 0.093Hz)
+#define DDS_HZ 100
+
+// register address bits D15/D14 (according to spec)
+#define FREQ0_ADDR  0x4000
+#define FREQ1_ADDR  0x8000
+#define PHASE_ADDR  0xC000  // D13 selects PHASE0/PHASE1
+#define PHASE0      0
+#define PHASE1      1
+
 
 // 16bit control register bits (according to spec)
 #define MODE      1
@@ -32,5 +52,23 @@ void DDSOff(void);
 void DDSInit(void);
 void DDSSignal (uint8_t signal);
 void DDSFreq(uint32_t frequenz);
+void DDSFreqRaw(uint32_t regist);
+void DDSFreqReg(uint8_t reg, uint32_t frequenz);
+uint32_t DDSFreqWord(uint32_t frequenz);
+uint32_t DDSFreqActual(uint32_t frequenz);
+void DDSSetup(uint8_t signal, uint32_t frequenz);
+void DDSWriteBurst(const uint16_t *data, uint8_t count);
+uint16_t DDSPhaseWord(uint16_t degrees);
+void DDSPhase(uint8_t reg, uint16_t degrees);
+void DDSPhaseSelect(uint8_t reg);
+void DDSFreqPhase(uint32_t frequenz, uint16_t degrees);
+uint16_t DDSControlGet(void);
+void DDSControlSet(uint16_t control);
+void DDSClockSet(uint32_t mclk);
+uint32_t DDSClockGet(void);
+uint32_t DDSClockMeasured(uint32_t frequenz, uint32_t edges);
+void DDSChannelSelect(uint8_t channels);
+uint8_t DDSChannelSelected(void);
+void DDSSync(const uint16_t *degrees);
 
 #endif
@@ -0,0 +1,144 @@
+/*
+ * BENCH.CPP: cycle counting benchmark firmware for the AD9833 function generator (USE_BENCH)
+ *
+ * Built by PlatformIO [env:bench] and run under simavr by bench/run_bench.py. At the end of
+ * setup() every hot path is called once while timer 1 counts CPU cycles, each result is printed
+ * as "BM_<name> <cycles>" (call overhead subtracted) at 115200 baud, then the CPU halts, which
+ * ends the simulation. The simulation is cycle exact, so the counts are the same on every run.
+ * Interrupt routines are called like functions (call instead of interrupt entry & vector jmp).
+ * The LCD isn't simulated: its I2C address gets NACKed, so EXTDisplayFlush() counts the
+ * address bytes only.
+*/
+
+#include "config.h"
+#include "hal.h"
+#include "ad9833.h"
+#include "external.h"
+#include "sweep.h"
+#include "bench.h"
+
+#ifdef USE_BENCH
+
+#define BENCH_BAUD 115200
+
+// interrupt routines of external.cpp
+extern "C" void TIMER0_COMPA_vect(void);
+extern "C" void TIMER1_COMPA_vect(void);
+extern "C" void PCINT2_vect(void);
+
+static uint32_t overhead = 0;
+static volatile uint32_t sink;
+
+// cycles of one call
+static uint32_t __attribute__((noinline)) cycles(void (*function)(void))
+{
+  HALCycleStart();
+  function();
+  return(HALCycleStop());
+}
+
+static void benchmark(const __FlashStringHelper *name, void (*function)(void))
+{
+  uint32_t count = cycles(function) - overhead;
+
+  Serial.print(F("BM_"));
+  Serial.print(name);
+  Serial.print(' ');
+  Serial.println(count);
+  Serial.flush();                               // no serial interrupt during the next count
+}
+
+static void none(void)
+{
+}
+
+static void freqWord(void)
+{
+  sink = DDSFreqWord(100000UL * DDS_HZ);
+}
+
+static void freqActual(void)
+{
+  sink = DDSFreqActual(100000UL * DDS_HZ);
+}
+
+static void freq(void)
+{
+  DDSFreq(100000UL * DDS_HZ);
+}
+
+static void dacVpp(void)
+{
+  EXTDacSetLevel(200, SINUS, V_P2P);
+}
+
+static void dacVrms(void)
+{
+  EXTDacSetLevel(100, SINUS, V_RMS);
+}
+
+static void displayFrequency(void)
+{
+  EXTDisplayFrequency(123456789UL, 0);
+}
+
+static void displayFlush(void)
+{
+  sink = EXTDisplayFlush();
+}
+
+static void tick(void)
+{
+  TIMER0_COMPA_vect();
+}
+
+static void encoder(void)
+{
+  PCINT2_vect();
+}
+
+#ifdef USE_SWEEP
+// word table only, SWPStart() reprograms timer 1 which is counting the cycles
+static void sweepTable(void)
+{
+  sink = SWPTable(1000UL * DDS_HZ, 100000UL * DDS_HZ, SWEEP_STEPS_MAX, SWEEP_LOG);
+}
+
+static void sweepStep(void)
+{
+  TIMER1_COMPA_vect();
+}
+#endif
+
+static void loopPass(void)
+{
+  loop();
+}
+
+// runs all benchmarks after setup(), never returns
+void BCHRun(void)
+{
+  Serial.begin(BENCH_BAUD);
+  overhead = cycles(none);
+  benchmark(F("DDSFreqWord"), freqWord);
+  benchmark(F("DDSFreqActual"), freqActual);
+  benchmark(F("DDSFreq"), freq);
+  benchmark(F("EXTDacSetLevel_Vpp"), dacVpp);
+  benchmark(F("EXTDacSetLevel_Vrms"), dacVrms);
+  benchmark(F("EXTDisplayFrequency"), displayFrequency);
+  benchmark(F("EXTDisplayFlush"), displayFlush);
+  benchmark(F("TIMER0_COMPA_vect"), tick);
+  benchmark(F("PCINT2_vect"), encoder);
+#ifdef USE_SWEEP
+  benchmark(F("SWPTable_log"), sweepTable);
+  SWPStart(1000UL * DDS_HZ, 100000UL * DDS_HZ, SWEEP_STEPS_MAX, SWEEP_DWELL_MIN, SWEEP_LOG);
+  benchmark(F("TIMER1_COMPA_vect_sweep"), sweepStep);
+  SWPStop();
+#endif
+  benchmark(F("loop"), loopPass);
+  Serial.println(F("BM_END"));
+  Serial.flush();
+  HALHalt();
+}
+
+#endif
@@ -0,0 +1,13 @@
+/*
+ * BENCH.H: cycle counting benchmark firmware for the AD9833 function generator
+*/
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+//
+// function declarations
+//
+void BCHRun(void);
+
+#endif
@@ -0,0 +1,197 @@
+/*
+ * BURST.CPP: gated N-cycle bursts for the AD9833 function generator
+ *
+ * The RESET bit of the AD9833 holds the phase accumulator at zero (output at midscale), so
+ * clearing it starts every burst at phase 0. Burst and pause lengths get computed from the
+ * tuning word & calibrated MCLK in timer 1 ticks (2MHz) and are counted by the timer in
+ * segments of max. 2^16 ticks, the compare ISR only sets the next segment and toggles RESET at
+ * both ends of a burst with a bare SPI write (same latency at start & end, so the burst length
+ * is exact). With several AD9833 channels all channels selected at BSTStart() get gated by the
+ * same write.
+ *
+ * External trigger: the pin change ISR restarts timer 1 and clears RESET directly. Trigger to
+ * first cycle estimated (not measured) at ~90 cycles (5.6us): interrupt response & prologue
+ * ~40, timer restart ~10, 16bit SPI write at 4MHz ~40. It grows by the time interrupts are
+ * blocked elsewhere, mainly SPI transactions in main code (up to ~20us for a 4 word DDS burst)
+ * and the 1ms tick ISR.
+*/
+
+#include "config.h"
+#include "hal.h"
+#include "ad9833.h"
+#include "external.h"
+#include "burst.h"
+
+#ifdef USE_BURST
+
+#define BURST_IDLE_TOP  32767                   // waiting for trigger (16ms)
+
+static uint16_t burstWord[2];                   // control words gated (RESET) & running
+static uint32_t burstOnTicks;
+static uint32_t burstOffTicks;
+static uint8_t  burstMode;
+static volatile uint32_t burstRemain;           // ticks left in actual phase after this segment
+static volatile uint8_t  burstGated;
+#if DDS_CHANNELS > 1
+static uint8_t  burstChannels;                  // channels gated (FSYNC low together)
+#define BURST_CHANNELS burstChannels
+#else
+#define BURST_CHANNELS 1
+#endif
+
+// timer 1 ticks (2MHz) per MCLK period in Q32: round(2^32 * 2MHz / mclk), binary long
+// division (53bit numerator, mclk < 2^25)
+static uint32_t burstTickRatio(uint32_t mclk)
+{
+  uint32_t rem = 0, ratio = 0;
+
+  for (uint8_t i = 0; i < 53; i++) {
+    rem <<= 1;
+    if (i < 21) rem |= (2000000UL >> (20 - i)) & 1;
+    ratio <<= 1;
+    if (rem >= mclk) {
+      rem -= mclk;
+      ratio |= 1;
+    }
+  }
+  if ((rem << 1) >= mclk) ratio++;
+  return(ratio);
+}
+
+// timer 1 ticks of cycles periods: cycles * 2^28 / word MCLK periods * ratio / 2^32
+// = cycles * ratio / (16 * word), binary long division (48bit numerator, word < 2^26)
+static uint32_t burstTicks(uint16_t cycles, uint32_t word, uint32_t ratio)
+{
+  uint32_t lo = (uint32_t)cycles * (uint16_t)ratio, hi = (uint32_t)cycles * (uint16_t)(ratio >> 16);
+  uint32_t low = lo + (hi << 16);
+  uint16_t high = (uint16_t)(hi >> 16) + (low < lo);    // numerator high:low
+  uint32_t div = word << 4, rem = 0, ticks = 0;
+
+  for (uint8_t i = 0; i < 48; i++) {
+    rem <<= 1;
+    rem |= (i < 16) ? (high >> (15 - i)) & 1 : (low >> (47 - i)) & 1;
+    if (ticks & 0x80000000UL) return 0xFFFFFFFFUL;    // saturate (>35min)
+    ticks <<= 1;
+    if (rem >= div) {
+      rem -= div;
+      ticks |= 1;
+    }
+  }
+  // round to nearest
+  if ((rem << 1) >= div) ticks++;
+  return((ticks < BURST_TICKS_MIN) ? BURST_TICKS_MIN : ticks);
+}
+
+// next segment of actual phase, returns timer top (the last segment is >= BURST_TICKS_MIN,
+// long enough to set the compare register before the counter passes it)
+static uint16_t burstSegment(void)
+{
+  uint32_t seg = burstRemain;
+
+  if (seg > 65536UL) seg = 32768;
+  burstRemain -= seg;
+  return((uint16_t)(seg - 1));
+}
+
+static inline void burstWrite(uint16_t word)
+{
+  HALDdsSelect(BURST_CHANNELS);
+  HALSpiWrite16(word);
+  HALDdsDeselect(BURST_CHANNELS);
+}
+
+// timer 1 compare handler, end of a segment: timer already counts the next one
+static void BSTSegment(void)
+{
+  if (!burstRemain) {
+    // phase complete
+    if (!burstGated) {
+      burstWrite(burstWord[0]);
+      burstGated = 1;
+      burstRemain = (burstMode == BURST_INT) ? burstOffTicks : 0;
+    }
+    else if (burstMode == BURST_INT) {
+      burstWrite(burstWord[1]);
+      burstGated = 0;
+      burstRemain = burstOnTicks;
+    }
+  }
+  HALTimer1Top(burstRemain ? burstSegment() : BURST_IDLE_TOP);
+}
+
+// starts a burst if gated & waiting for trigger, timer restarted before the SPI write
+// (the ISR at burst end has a similar latency)
+static inline void burstFire(void)
+{
+  if (burstMode != BURST_EXT || !burstGated || !BSTRunning()) return;
+  burstRemain = burstOnTicks;
+  HALTimer1Restart(burstSegment());
+  burstWrite(burstWord[1]);
+  burstGated = 0;
+}
+
+// trigger input pin change interrupt routine, falling edge only (retrigger ignored during burst)
+ISR(PCINT1_vect)
+{
+  if (HALTrigger()) burstFire();
+}
+
+// software trigger (e.g. remote command), same as falling edge at trigger input
+void BSTTrigger(void)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    burstFire();
+  }
+}
+
+// sets frequency & starts bursts of cycles periods, mode BURST_INT repeats every period (ms),
+// BURST_EXT waits for trigger, output is gated (RESET) in between
+void BSTStart(uint8_t mode, uint16_t cycles, uint16_t period, uint32_t frequ)
+{
+  uint32_t word, periodTicks;
+
+  BSTStop();
+  if (mode == BURST_OFF) return;
+  cycles = (cycles < BURST_CYCLES_MIN) ? BURST_CYCLES_MIN : cycles;
+  period = (period < BURST_PERIOD_MIN) ? BURST_PERIOD_MIN : ((period > BURST_PERIOD_MAX) ? BURST_PERIOD_MAX : period);
+
+  DDSFreq(frequ);
+  word = DDSFreqWord(frequ);
+  burstOnTicks = burstTicks(cycles, word ? word : 1, burstTickRatio(DDSClockGet()));
+  // burst longer than period: shortest pause
+  periodTicks = (uint32_t)period * 2000;
+  burstOffTicks = (periodTicks > burstOnTicks + BURST_TICKS_MIN) ? periodTicks - burstOnTicks : BURST_TICKS_MIN;
+  burstMode = mode;
+#if DDS_CHANNELS > 1
+  burstChannels = DDSChannelSelected();
+#endif
+
+  burstWord[1] = DDSControlGet() & ~(1 << RESET);
+  burstWord[0] = burstWord[1] | (1 << RESET);
+  DDSControlSet(burstWord[0]);
+  burstGated = 1;
+  burstRemain = 0;
+  // timer 1 at 2MHz, BURST_INT: first burst after shortest pause
+  EXTTimer1Start(BSTSegment, T1_PRESCALER_8, (mode == BURST_INT) ? BURST_TICKS_MIN - 1 : BURST_IDLE_TOP);
+  if (mode == BURST_EXT) {
+    HALTriggerInit();
+    HALTriggerIrq(1);
+  }
+}
+
+// stops bursts, output continues ungated
+void BSTStop(void)
+{
+  HALTriggerIrq(0);
+  if (BSTRunning()) {
+    EXTTimer1Stop(BSTSegment);
+    DDSControlSet(burstWord[1]);
+  }
+}
+
+uint8_t BSTRunning(void)
+{
+  return(EXTTimer1Owner(BSTSegment));
+}
+
+#endif
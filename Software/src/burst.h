@@ -0,0 +1,27 @@
+/*
+ * BURST.H: gated N-cycle bursts for the AD9833 function generator
+*/
+
+#ifndef BURST_H_
+#define BURST_H_
+
+// burst modes
+#define BURST_OFF 0
+#define BURST_INT 1         // one burst every period
+#define BURST_EXT 2         // one burst per falling edge at trigger input (PC1/A1, pull-up)
+
+#define BURST_CYCLES_MIN  1
+#define BURST_CYCLES_MAX  65535
+#define BURST_PERIOD_MIN  1                   // ms
+#define BURST_PERIOD_MAX  60000
+#define BURST_TICKS_MIN   64                  // timer 1 ticks (0.5us), shortest burst/pause
+
+//
+// function declarations
+//
+void    BSTStart(uint8_t mode, uint16_t cycles, uint16_t period, uint32_t frequ);
+void    BSTStop(void);
+void    BSTTrigger(void);
+uint8_t BSTRunning(void);
+
+#endif
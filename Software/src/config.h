@@ -0,0 +1,22 @@
+/*
+ * CONFIG.H: compile time options for the AD9833 function generator
+ *           (the Atmega168 only has 16kB flash & 1kB RAM, so not all options fit at once)
+*/
+
+#ifndef CONFIG_H_
+#define CONFIG_H_
+
+#define USE_WDT           // uncomment for using watchdog
+//#define USE_SERIAL        // uncomment for using serial output
+#define USE_SWEEP         // uncomment for frequency sweep mode (uses timer 1)
+//#define USE_MODULATION    // uncomment for FSK/PSK/OOK modulation mode (uses timer 1)
+//#define USE_ENVELOPE      // uncomment for AM/envelope of the output level (uses timer 1, AM:xxx needs USE_SERIAL)
+//#define USE_BURST         // uncomment for gated N-cycle bursts, internal or triggered at PC1 (uses timer 1, BURS:xxx needs USE_SERIAL)
+//#define USE_COUNTER       // uncomment for frequency counter at T1/PD5 & MCLK calibration (uses timer 1, long press)
+//#define USE_FLATNESS      // uncomment for amplitude flatness correction (calibration with CAL:xxx needs USE_SERIAL)
+//#define USE_PROBES        // uncomment for latency measurement (needs USE_SERIAL, SYST:PROB?)
+//#define DDS_CHANNELS 2    // uncomment for 2...4 phase coherent AD9833 channels with common MCLK (FSYNC at PB2, PC2, PC3, PD6)
+
+#define PERSIST_DELAY 3000  // ms without setting changes before they get stored in EEPROM
+
+#endif
@@ -0,0 +1,84 @@
+/*
+ * ENVELOPE.CPP: timer clocked amplitude modulation/envelope for the AD9833 function generator
+ *
+ * The multiplying DAC AD5452 sets the output level, so streaming DAC codes modulates the
+ * amplitude. When started, the envelope shape (PROGMEM) gets scaled with depth and the actual
+ * DAC code into a RAM table of ready DAC words. The timer 1 compare ISR then steps a 32bit phase
+ * accumulator at ENV_SAMPLE_RATE and sends one word with a bare 16bit SPI write: no transaction
+ * needed, since SPI transactions in main code have the timer interrupt masked (usingInterrupt)
+ * and AD9833 & AD5452 both use SPI mode 2.
+*/
+
+#include "config.h"
+#include "hal.h"
+#include "external.h"
+#include "envelope.h"
+
+#ifdef USE_ENVELOPE
+
+// shapes with ENV_SAMPLES samples, 255 is full level
+static const uint8_t envShapes[3][ENV_SAMPLES] PROGMEM = {
+  // ENV_SIN
+  { 128, 152, 176, 198, 218, 234, 245, 253, 255, 253, 245, 234, 218, 198, 176, 152,
+    128, 103,  79,  57,  37,  21,  10,   2,   0,   2,  10,  21,  37,  57,  79, 103 },
+  // ENV_RAMP
+  {   0,   8,  16,  25,  33,  41,  49,  58,  66,  74,  82,  90,  99, 107, 115, 123,
+    132, 140, 148, 156, 165, 173, 181, 189, 197, 206, 214, 222, 230, 239, 247, 255 },
+  // ENV_ADSR
+  {  64, 128, 191, 255, 234, 212, 191, 170, 170, 170, 170, 170, 170, 170, 170, 170,
+    170, 170, 170, 170, 149, 128, 106,  85,  64,  42,  21,   0,   0,   0,   0,   0 }
+};
+
+static uint16_t envWord[ENV_SAMPLES];           // DAC words of one envelope period
+static uint32_t envPhase;
+static uint32_t envStep;                        // phase increment per sample
+static uint8_t  envActive = 0;                  // DAC shows envelope, must be restored
+
+// timer 1 compare handler, one DAC word per sample
+static void ENVSample(void)
+{
+  HALSpiSelect(HAL_CS_DAC);
+  HALSpiWrite16(envWord[envPhase >> 27]);
+  HALSpiDeselect(HAL_CS_DAC);
+  envPhase += envStep;
+}
+
+// starts envelope with actual DAC code as full level: depth 0...100%, rate 1...500Hz
+void ENVStart(uint8_t shape, uint8_t depth, uint16_t rate, uint16_t code)
+{
+  uint8_t sample;
+
+  ENVStop();
+  if (shape == ENV_OFF || shape > ENV_ADSR) return;
+  depth = (depth > ENV_DEPTH_MAX) ? ENV_DEPTH_MAX : depth;
+  rate = (rate < ENV_RATE_MIN) ? ENV_RATE_MIN : ((rate > ENV_RATE_MAX) ? ENV_RATE_MAX : rate);
+
+  // level = code * (1 - depth * (1 - shape)), integer only
+  for (uint8_t i = 0; i < ENV_SAMPLES; i++) {
+    sample = pgm_read_byte(&envShapes[shape - 1][i]);
+    envWord[i] = DAC_WORD(code - (uint16_t)(((uint32_t)code * depth * (255 - sample)) / (ENV_DEPTH_MAX * 255UL)));
+  }
+  // 2^32 * rate / ENV_SAMPLE_RATE
+  envStep = (uint32_t)rate * ((1UL << 31) / (ENV_SAMPLE_RATE / 2));
+  envPhase = 0;
+  envActive = 1;
+  // timer 1 at 2MHz, one sample every 2000000/ENV_SAMPLE_RATE ticks
+  EXTTimer1Start(ENVSample, T1_PRESCALER_8, (uint16_t)(2000000UL / ENV_SAMPLE_RATE - 1));
+}
+
+// stops envelope, DAC gets back the static level (also if another engine took timer 1 over)
+void ENVStop(void)
+{
+  if (ENVRunning()) EXTTimer1Stop(ENVSample);
+  if (envActive) {
+    envActive = 0;
+    EXTDacRefresh();
+  }
+}
+
+uint8_t ENVRunning(void)
+{
+  return(EXTTimer1Owner(ENVSample));
+}
+
+#endif
@@ -0,0 +1,27 @@
+/*
+ * ENVELOPE.H: timer clocked amplitude modulation/envelope for the AD9833 function generator
+*/
+
+#ifndef ENVELOPE_H_
+#define ENVELOPE_H_
+
+// envelope shapes
+#define ENV_OFF   0
+#define ENV_SIN   1         // sinusoidal AM
+#define ENV_RAMP  2         // sawtooth, rising
+#define ENV_ADSR  3         // attack, decay, sustain, release, pause
+
+#define ENV_SAMPLES     32                    // samples per envelope period (RAM table)
+#define ENV_SAMPLE_RATE 8000                  // Hz, timer 1 with prescaler 8, ISR takes ~8us
+#define ENV_RATE_MIN    1                     // Hz, envelope periods per second
+#define ENV_RATE_MAX    500
+#define ENV_DEPTH_MAX   100                   // %
+
+//
+// function declarations
+//
+void    ENVStart(uint8_t shape, uint8_t depth, uint16_t rate, uint16_t code);
+void    ENVStop(void);
+uint8_t ENVRunning(void);
+
+#endif
@@ -6,71 +6,154 @@
  * Author : ThJ (yellobyte@bluewin.ch)
 */
 
-#include <Arduino.h>
-#include <SPI.h>
-#include <LiquidCrystal_I2C.h>
+#include "config.h"
+#include "hal.h"
 #include "ad9833.h"
 #include "external.h"
+#include "sweep.h"
+#include "probe.h"
 
-#define PIN_RELAY         PIN_PB0
-#define PIN_BUZZER        PIN_PC0
-#define PIN_ENCODERA      PIN_PD2
-#define PIN_ENCODERB      PIN_PD3
-#define PIN_ENCODERBUTTON PIN_PD4
-#define PIN_PUSHBUTTON    PIN_PD7
-#define PIN_AD5452_CS     PIN_PB1
-#define SPI_AD5452        SPISettings(2000000, MSBFIRST, SPI_MODE2)
+#define AD5452_SPI_CLOCK  2000000         // Hz
 
-extern LiquidCrystal_I2C  lcd;
-extern uint8_t            outputLevelStepSize;
+#define DEBOUNCE_TICKS    EXT_MS_TICKS(5)     // input must be stable
+#define LONG_PRESS_TICKS  EXT_MS_TICKS(500)   // shorter is short press
+#define MAX_PRESS_TICKS   EXT_MS_TICKS(5000)  // longer is ignored
+#define ACCEL_TICKS       EXT_MS_TICKS(40)    // faster detents count as fast spin
+#define ACCEL_DETENTS     4               // fast detents per acceleration level
+#define ACCEL_MAX         6               // max acceleration level (step size * 10^6)
 
-volatile uint8_t rotaryImpulseLeft = 0;
-volatile uint8_t rotaryImpulseRight = 0;
+static volatile uint8_t  rotaryAccel = 0;            // acceleration level (step size * 10^n)
+static volatile uint16_t tickCount = 0;              // 1ms ticks
+
+// event queue, filled by the ISRs (single producer), emptied by loop() (single consumer)
+#define EVENT_QUEUE_SIZE 16                          // power of 2
+static volatile uint8_t  eventQueue[EVENT_QUEUE_SIZE];
+static volatile uint8_t  eventHead = 0, eventTail = 0;
+
+// software timers, count down in 1ms tick
+static volatile uint16_t timerTicks[EXT_TIMERS];
+
+// debounced buttons, both at PORTD
+#define BUTTON_SELECT     HAL_BUTTON_SELECT
+#define BUTTON_ENCODER    HAL_BUTTON_ENCODER
+#define BUTTON_MASK       (BUTTON_SELECT | BUTTON_ENCODER)
+static volatile uint8_t buttonStable = BUTTON_MASK;       // high...not pressed
+
+//
+// shadow buffer of the 16x2 LCD display: the display functions only render into lcdShadow,
+// EXTDisplayFlush() sends the cells differing from lcdShown (what the LCD actually shows)
+//
+#define LCD_COLS 16
+#define LCD_ROWS 2
+
+static char     lcdShadow[LCD_ROWS][LCD_COLS];
+static char     lcdShown[LCD_ROWS][LCD_COLS];
+static uint8_t  lcdCol = 0, lcdRow = 0;           // render position
+static uint8_t  lcdCursorCol = 0, lcdCursorRow = 0;
+static uint16_t lcdRendered = 0;                  // LCD bytes direct output would have needed
+
+static void displayAt(uint8_t col, uint8_t row)
+{
+  lcdCol = col;
+  lcdRow = row;
+  lcdRendered++;                                  // setCursor command
+}
+
+static void displayChar(char c)
+{
+  if (lcdCol < LCD_COLS) lcdShadow[lcdRow][lcdCol++] = c;
+  lcdRendered++;
+}
+
+static void displayText(const char *text)
+{
+  while (*text) displayChar(*text++);
+}
+
+static void displayNumber(uint16_t number)
+{
+  char     buffer[6];
+  uint8_t  i = 0;
+
+  do {
+    buffer[i++] = (char)('0' + number % 10);
+    number /= 10;
+  } while (number);
+  while (i) displayChar(buffer[--i]);
+}
+
+// clears LCD and shadow buffer (e.g. after start messages written directly to the LCD)
+void EXTDisplayClear(void)
+{
+  HALLcdClear();
+  memset(lcdShadow, ' ', sizeof(lcdShadow));
+  memset(lcdShown, ' ', sizeof(lcdShown));
+  lcdCursorCol = lcdCursorRow = 0;
+  lcdRendered = 0;
+}
+
+// places the LCD cursor (editing position), gets restored after every flush
+void EXTDisplayCursor(uint8_t col, uint8_t row)
+{
+  lcdCursorCol = col;
+  lcdCursorRow = row;
+  HALLcdGoto(col, row);
+}
+
+// sends changed cells only, setCursor only when the cell doesn't follow the last written one,
+// returns the number of LCD bytes (characters & commands) saved compared to direct output
+uint16_t EXTDisplayFlush(void)
+{
+  uint8_t  col, row, next = 0xFF;
+  uint16_t sent = 0, saved;
+
+  for (row = 0; row < LCD_ROWS; row++) {
+    for (col = 0; col < LCD_COLS; col++) {
+      if (lcdShadow[row][col] != lcdShown[row][col]) {
+        if (col != next) {
+          HALLcdGoto(col, row);
+          sent++;
+        }
+        HALLcdWrite(lcdShown[row][col] = lcdShadow[row][col]);
+        sent++;
+        next = col + 1;
+      }
+    }
+    next = 0xFF;                                  // DDRAM addresses of both rows aren't consecutive
+  }
+  if (sent) {
+    HALLcdGoto(lcdCursorCol, lcdCursorRow);
+    sent++;
+  }
+  saved = (lcdRendered > sent) ? lcdRendered - sent : 0;
+  lcdRendered = 0;
+  return(saved);
+}
 
 //
 // functions for displaying frequency, waveform and output level on 16x2 LCD display
 //
-void EXTDisplayFrequency(uint32_t frequ, uint8_t leadingZeros)
+// frequency (1/100 Hz) as "ddddddd.ddHz" at col 4-15, leading zeros are blanked down to the 1Hz
+// digit resp. down to the digit being edited (value of that digit in 1/100 Hz, 0 if none)
+void EXTDisplayFrequency(uint32_t frequ, uint32_t editDigit)
 {
-  uint8_t  i;
-  uint8_t	 digit[7];
-  uint32_t temp;
+  uint8_t  i, blank = 1;
+  uint8_t	 digit[9];
+  uint32_t temp, weight;
 
-  temp = (frequ < 10000000) ? frequ : 9999999;
-  for (i = 0; i < 7; i++) digit[i] = 0; // clear array
-  for (i = 0; temp > 0; i++) {
-    digit[6-i] = (uint8_t)(temp % 10);
+  temp = (frequ < 1000000000UL) ? frequ : 999999999UL;
+  for (i = 0; i < 9; i++) {
+    digit[8-i] = (uint8_t)(temp % 10);
     temp = temp / 10;
   }
-  lcd.setCursor(4,0);
-  for (i = 0; i < 7; i++) {
-    if (i == 0) {
-      if ( digit[0] != 0 ) {
-        lcd.print((char)(48+digit[0]));
-        lcd.print((char)'.'); 
-      }
-      else {
-         lcd.print((char)' ');
-         lcd.print((char)' ');
-      }
-    }
-    else if ( i == 1 && digit[0] == 0 && digit[1] == 0 && !(leadingZeros == 2) ) {
-       lcd.print((char)' ');
-    }
-    else if ( i == 2 && digit[0] == 0 && digit[1] == 0 && digit[2] == 0 && leadingZeros == 0 ) {
-       lcd.print((char)' ');
-    }
-    else if (i == 3) {
-      lcd.print((char)(48+digit[i]));
-      lcd.print((char)'.'); 
-    }
-    else {
-      lcd.print((char)(48+digit[i])); 
-    }
+  displayAt(4,0);
+  for (i = 0, weight = 100000000UL; i < 9; i++, weight /= 10) {
+    if (digit[i] != 0 || weight <= editDigit || weight <= DDS_HZ) blank = 0;
+    displayChar(blank ? (char)' ' : (char)(48+digit[i]));
+    if (i == 6) displayChar((char)'.');
   }
-  lcd.print((char)'k');
-  lcd.print((char)'H');
-  lcd.print((char)'z');
+  displayChar((char)'H');
+  displayChar((char)'z');
 }
 
 void EXTDisplayLevel(uint16_t outputLevel, uint8_t outputLevelMode)
@@ -84,162 +167,470 @@ void EXTDisplayLevel(uint16_t outputLevel, uint8_t outputLevelMode)
   digits[1] = (uint8_t)(temp % 10);
   temp /= 10;
   digits[0] = (uint8_t)(temp % 10);
-  lcd.setCursor(9,1);
-  lcd.print((char)(48+digits[0]));
-  lcd.print((char)'.');
-  lcd.print((char)(48+digits[1]));
-  lcd.print((char)(48+digits[2]));
+  displayAt(9,1);
+  displayChar((char)(48+digits[0]));
+  displayChar((char)'.');
+  displayChar((char)(48+digits[1]));
+  displayChar((char)(48+digits[2]));
 
-  lcd.setCursor(13,1);
-  lcd.print(outputLevelMode ? "Vpp" : "Vrm");
+  displayAt(13,1);
+  displayText(outputLevelMode ? "Vpp" : "Vrm");
 }
 
 void EXTDisplayWaveform(uint8_t waveform)
 {
   switch (waveform){
     case SINUS:
-      lcd.setCursor(0,1);
-      lcd.print("SINUS   "); 
+      displayAt(0,1);
+      displayText("SINUS   "); 
       break;
     case SQUARE:
-      lcd.setCursor(0,1);
-      lcd.print("SQUARE    5V-TTL"); 
+      displayAt(0,1);
+      displayText("SQUARE    5V-TTL"); 
       break;
     case TRIANGLE:
-      lcd.setCursor(0,1);
-      lcd.print("TRIANGLE");
+      displayAt(0,1);
+      displayText("TRIANGLE");
       break;
     default:
       break;
   }	
 }
 
+// shows output off in front of frequency (line 1, col 0-3)
+void EXTDisplayOutputState(uint8_t enabled)
+{
+  displayAt(0,0);
+  displayText(enabled ? "    " : "OFF ");
+}
+
+// shows preset number in front of frequency (line 1, col 0-3), rest of display cleared if empty
+void EXTDisplayPreset(uint8_t slot, uint8_t used)
+{
+  displayAt(0,0);
+  displayChar('P');
+  displayChar((char)('1' + slot));
+  displayText("  ");
+  if (!used) {
+    displayText("   empty    ");
+    displayAt(0,1);
+    displayText("                ");
+  }
+}
+
+#ifdef USE_SWEEP
+// shows sweep parameters: stop frequency in line 1, "LIN  32x 1000ms " in line 2
+void EXTDisplaySweep(uint8_t law, uint8_t steps, uint16_t dwell, uint32_t stopFrequ)
+{
+  displayAt(0,0);
+  displayText("Stop");
+  EXTDisplayFrequency(stopFrequ * DDS_HZ,0);
+
+  displayAt(0,1);
+  displayText((law == SWEEP_LIN) ? "LIN  " : ((law == SWEEP_LOG) ? "LOG  " : "OFF  "));
+  if (steps < 10) displayChar((char)' ');
+  displayNumber(steps);
+  displayText("x ");
+  for (uint16_t d = 1000; d > 1 && dwell < d; d /= 10) displayChar((char)' ');
+  displayNumber(dwell);
+  displayText("ms ");
+}
+
+// shows running sweep in front of frequency (line 1, col 0-3)
+void EXTDisplaySweepState(uint8_t law)
+{
+  displayAt(0,0);
+  displayText((law == SWEEP_LIN) ? "LIN " : ((law == SWEEP_LOG) ? "LOG " : "    "));
+}
+#endif
+
+#ifdef USE_COUNTER
+// shows measured frequency in line 1, "MCLK    +12ppm  " resp. "CAL MCLK 16s... " in line 2
+void EXTDisplayCounter(uint32_t frequ, uint8_t calibrating, uint32_t mclk)
+{
+  int32_t  diff = (int32_t)(mclk - AD9833_MCLK);
+  uint16_t ppm = (uint16_t)((((diff < 0) ? -diff : diff) + AD9833_MCLK / 2000000UL) / (AD9833_MCLK / 1000000UL));
+
+  displayAt(0,0);
+  displayText("CNT ");
+  EXTDisplayFrequency(frequ,0);
+
+  displayAt(0,1);
+  if (calibrating) {
+    displayText("CAL MCLK 16s... ");
+    return;
+  }
+  displayText("MCLK  ");
+  for (uint16_t d = 1000; d > 1 && ppm < d; d /= 10) displayChar((char)' ');
+  displayChar((diff < 0) ? '-' : '+');
+  displayNumber(ppm);
+  displayText("ppm  ");
+}
+#endif
+
 //
 // functions for handling the relais
 //
 void EXTRelaisInit(void)
 {
-  pinMode(PIN_RELAY, OUTPUT);   
-  digitalWrite(PIN_RELAY, LOW);     // relais off
+  HALRelaisInit();                  // relais off
 }
 
 void EXTRelaisOnOff(uint8_t setting)
 {
-  if ( setting == RELAIS_ON )
-    digitalWrite(PIN_RELAY, HIGH);  // relais on
-  else
-    digitalWrite(PIN_RELAY, LOW);   // relais off
+  HALRelais(setting == RELAIS_ON);
 }
 
 //
 // functions for handling the buzzer
 //
+// patterns: alternating on/off times in ticks of 1.024ms, ending with a pause, 0 terminated
+#define BUZZER_QUEUE_SIZE 4         // power of 2
+
+static const uint8_t buzzerPatterns[][6] PROGMEM = {
+  { EXT_MS_TICKS(10), EXT_MS_TICKS(20), 0 },                                          // BUZZER_CLICK
+  { EXT_MS_TICKS(80), EXT_MS_TICKS(60), 0 },                                          // BUZZER_SINGLE
+  { EXT_MS_TICKS(40), EXT_MS_TICKS(60), EXT_MS_TICKS(40), EXT_MS_TICKS(60), 0 },      // BUZZER_DOUBLE
+  { EXT_MS_TICKS(250), EXT_MS_TICKS(60), 0 }                                          // BUZZER_ERROR
+};
+static volatile uint8_t buzzerQueue[BUZZER_QUEUE_SIZE];
+static volatile uint8_t buzzerHead = 0, buzzerTail = 0;
+static const uint8_t * volatile buzzerStep = 0; // actual position in pattern, 0 if idle
+static uint8_t          buzzerTicks = 0;
+
 void EXTBuzzerInit(void)
 {
-  pinMode(PIN_BUZZER, OUTPUT);   
-  digitalWrite(PIN_BUZZER, LOW);   // buzzer off
+  HALBuzzerInit();                 // buzzer off
 }
 
-void EXTBuzzerRing(uint16_t ms)
+// queues a pattern and returns immediately, patterns get dropped when queue is full
+void EXTBuzzerPlay(uint8_t pattern)
 {
-  digitalWrite(PIN_BUZZER, HIGH);  // buzzer on
-  delay(ms);					             // Buzzer x ms aktiv
-  digitalWrite(PIN_BUZZER, LOW);   // buzzer off
+  uint8_t next = (buzzerHead + 1) & (BUZZER_QUEUE_SIZE - 1);
+
+  if (next != buzzerTail) {
+    buzzerQueue[buzzerHead] = pattern;
+    buzzerHead = next;
+  }
+}
+
+uint8_t EXTBuzzerBusy(void)
+{
+  return(buzzerStep || buzzerHead != buzzerTail);
 }
 
+// called every tick, switches buzzer according to actual pattern
+static inline void buzzerTick(void)
+{
+  if (buzzerTicks && --buzzerTicks) return;
+  if (!buzzerStep && buzzerHead != buzzerTail) {
+    buzzerStep = buzzerPatterns[buzzerQueue[buzzerTail]];
+    buzzerTail = (buzzerTail + 1) & (BUZZER_QUEUE_SIZE - 1);
+  }
+  if (buzzerStep) {
+    if ((buzzerTicks = pgm_read_byte(buzzerStep)) != 0) {
+      // even positions are on times (all patterns have even size)
+      HALBuzzer(!((buzzerStep - buzzerPatterns[0]) & 1));
+      buzzerStep++;
+    }
+    else {
+      HALBuzzer(0);                 // buzzer off, pattern finished
+      buzzerStep = 0;
+    }
+  }
+}
+
+
 //
-// functions for handling the select button
+// event queue: lock free, only ISRs put events, only loop() gets them
 //
-void EXTSelectSwitchInit(void)
+static void eventPut(uint8_t event)
 {
-  pinMode(PIN_PUSHBUTTON, INPUT_PULLUP);   
+  uint8_t next = (eventHead + 1) & (EVENT_QUEUE_SIZE - 1);
+
+  if (next != eventTail) {                            // event gets dropped if queue is full
+    eventQueue[eventHead] = event;
+    eventHead = next;
+  }
+  if (event < EV_TIMER) PROBE_MARK();
 }
 
-uint8_t EXTSelectSwitchCheck(void)
+// returns next event or EV_NONE
+uint8_t EXTEventGet(void)
 {
-  // function returns: 1...button was pressed, 0...otherwise
-  static uint8_t oldStatus = 1;                         // default - switch not pressed
-  uint8_t	status, ret = 0;
- 
-  status = digitalRead(PIN_PUSHBUTTON);
-  if (!status && oldStatus) {                           // any input change ?
-    for (uint8_t n = 0; n < 5; ) {
-      delayMicroseconds(200);
-      n = !digitalRead(PIN_PUSHBUTTON) ? n + 1 : 0;
-    }
-    // since 5 * 200us = 1ms no change at input
-    ret = 1;
-    oldStatus = status;                                 // remember last stable signal
+  uint8_t event;
+
+  if (eventTail == eventHead) return(EV_NONE);
+  event = eventQueue[eventTail];
+  eventTail = (eventTail + 1) & (EVENT_QUEUE_SIZE - 1);
+  return(event);
+}
+
+// drops all pending events (e.g. from power on phase)
+void EXTEventFlush(void)
+{
+  eventTail = eventHead;
+}
+
+// sleeps (idle mode, timers & interrupts keep running) until an event is pending,
+// wakes up at least every 1ms (tick)
+void EXTEventWait(void)
+{
+  HALIrqDisable();
+  if (eventTail == eventHead) HALSleep();            // no event gets lost before sleeping
+  HALIrqEnable();
+}
+
+//
+// software timers: EV_TIMER + timer gets created after ms (counted in ticks of 1.024ms)
+//
+void EXTTimerStart(uint8_t timer, uint16_t ms)
+{
+  uint16_t ticks = EXT_MS_TICKS(ms);
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    timerTicks[timer] = ticks;
   }
-  else {
-    oldStatus = status;                                 // remember last reading
-  }  
-  return(ret);
 }
 
+void EXTTimerStop(uint8_t timer)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    timerTicks[timer] = 0;
+  }
+}
+
+//
+// functions for handling the select button
+//
+void EXTSelectSwitchInit(void)
+{
+  HALInputInit(HAL_BUTTON_SELECT);
+}
+
+
 //
 // functions handling the rotary encoder & button
 //
-static void impulsIrq()
+// quadrature decoder, index: previous BA state << 2 | new BA state, value: direction (left -1)
+// (left turn: BA 11 -> 10 -> 00 -> 01 -> 11, invalid transitions (bounce) count 0)
+static const int8_t rotaryTable[16] PROGMEM = {
+  0, -1, 1, 0, 1, 0, 0, -1, -1, 0, 0, 1, 0, 1, -1, 0
+};
+
+// pin change interrupt routine of encoder A (PD2) & B (PD3), one event per detent (AB 11)
+ISR(PCINT2_vect)
 {
-  // PIN_ENCODERB==1 -> left turn,  PIN_ENCODERB==0 -> right turn
-  if (digitalRead(PIN_ENCODERB)) {
-    rotaryImpulseLeft++;
+  static uint8_t  state = 3;
+  static int8_t   steps = 0;
+  static uint8_t  fastDetents = 0;
+  static uint16_t lastDetent = 0;
+  uint16_t        interval;
+
+  state = ((state << 2) | ((HALInputs() >> HAL_ENCODER_SHIFT) & 3)) & 0x0F;
+  steps += (int8_t)pgm_read_byte(&rotaryTable[state]);
+  if ((state & 3) != 3) return;
+  if (steps > -2 && steps < 2) {
+    steps = 0;                            // back at detent without a full impulse
+    return;
   }
-  else {
-    rotaryImpulseRight++;
+
+  // detent reached, spin velocity from time between detents
+  interval = tickCount - lastDetent;
+  lastDetent = tickCount;
+  if (interval >= ACCEL_TICKS) fastDetents = rotaryAccel = 0;
+  else if (++fastDetents >= ACCEL_DETENTS && rotaryAccel < ACCEL_MAX) {
+    fastDetents = 0;
+    rotaryAccel++;
   }
-  // trailing spikes will be ignored for some time
-  delayMicroseconds(50);
+  eventPut((steps < 0) ? EV_LEFT : EV_RIGHT);
+  steps = 0;
 }
 
 void EXTRotaryInit(void)
 {
-  pinMode(PIN_ENCODERBUTTON, INPUT_PULLUP);
-  pinMode(PIN_ENCODERB, INPUT_PULLUP);
-  pinMode(PIN_ENCODERA, INPUT_PULLUP);
-  attachInterrupt(digitalPinToInterrupt(PIN_ENCODERA),impulsIrq,FALLING);
+  HALInputInit(HAL_BUTTON_ENCODER | HAL_ENCODER_B | HAL_ENCODER_A);
+  HALEncoderIrqInit();
 }
 
-buttonEvent EXTRotaryButtonCheck(void)
+// debounced state of encoder button: 1...pressed
+uint8_t EXTRotaryButtonPressed(void)
 {
-  // function returns: 1...short press (<0.5s), 2...long press (>0.5s-3s), 0...otherwise
-  static uint8_t oldStatus = 1;                             // default - button not pressed
-  uint8_t	status;
-  buttonEvent event = idle;
- 
-  status = digitalRead(PIN_ENCODERBUTTON);
-  if (!status && oldStatus) {                               // falling edge ?
-    for (uint8_t n = 0; n < 5; ) {                          // wait for stable low
-      delayMicroseconds(200);
-      n = !digitalRead(PIN_ENCODERBUTTON) ? n + 1 : 0;
-    }
-    for (uint16_t n = 1; status == LOW && n < 50; ) {       // wait for rising edge
-      delay(100);
-      if (!(status = digitalRead(PIN_ENCODERBUTTON))) n++;  // input still low -> knob still pressed
-      else event = (n < 5) ? shortPress : longPress;        // input high again -> knob was released
+  return(!(buttonStable & BUTTON_ENCODER));
+}
+
+// acceleration level of actual spin: 0...slow, step size to be multiplied by 10^level
+uint8_t EXTRotaryAcceleration(void)
+{
+  return(rotaryAccel);
+}
+
+
+//
+// 1ms tick: timer 0 (millis() of Arduino core, overflow every 1.024ms) compare match A,
+// drives buzzer & software timers and samples the buttons
+//
+void EXTTickInit(void)
+{
+  HALTickInit();
+}
+
+// returns 1 when button input reached a new state, stable for DEBOUNCE_TICKS
+static inline uint8_t debounce(uint8_t pins, uint8_t button, uint8_t *count)
+{
+  if (!((pins ^ buttonStable) & button)) *count = 0;
+  else if (++(*count) >= DEBOUNCE_TICKS) {
+    *count = 0;
+    buttonStable ^= button;
+    return(1);
+  }
+  return(0);
+}
+
+// samples both buttons, events: select switch on press, encoder button on release
+// depending on press duration
+static inline void buttonTick(void)
+{
+  static uint8_t  selectCount = 0, encoderCount = 0;
+  static uint16_t pressTicks = 0;
+  uint8_t         pins = HALInputs();
+
+  if (debounce(pins, BUTTON_SELECT, &selectCount) && !(buttonStable & BUTTON_SELECT)) {
+    eventPut(EV_SELECT);
+  }
+  if (debounce(pins, BUTTON_ENCODER, &encoderCount)) {
+    if (!(buttonStable & BUTTON_ENCODER)) pressTicks = 0;
+    else if (pressTicks < MAX_PRESS_TICKS) {
+      eventPut((pressTicks < LONG_PRESS_TICKS) ? EV_SHORT : EV_LONG);
     }
-    oldStatus = status;                                     // remember last stable signal
   }
-  else {
-    oldStatus = status;                                     // remember last reading
+  if (!(buttonStable & BUTTON_ENCODER) && pressTicks < MAX_PRESS_TICKS) pressTicks++;
+}
+
+#ifdef USE_COUNTER
+//
+// frequency counter: timer 1 counts rising edges at T1 (PD5), wrapping every 65536 edges.
+// The tick takes a snapshot of the edge count every gate, gates follow each other without
+// gap. Gate time is exact (ticks of 1.024ms from the 16MHz crystal), the snapshot jitters
+// only by the tick ISR latency (a few us), so the crystal limits the accuracy.
+//
+static volatile uint16_t counterWraps = 0;
+static volatile uint16_t counterGate = 0;           // ticks per gate, 0...counter off
+static uint16_t          counterTicks;
+static uint8_t           counterPrimed;             // first snapshot taken
+static uint32_t          counterLast;
+static volatile uint32_t counterEdges = 0;          // edges within last gate
+
+static void counterWrap(void)
+{
+  counterWraps++;
+}
+
+// called every tick (interrupts disabled), a wrap not yet handled by its ISR gets added
+static inline void counterTick(void)
+{
+  uint16_t low, high;
+  uint32_t count;
+
+  if (!counterGate || --counterTicks) return;
+  if (!EXTTimer1Owner(counterWrap)) {
+    counterGate = 0;                                // timer 1 taken over by an engine
+    return;
   }
-  return(event);
+  counterTicks = counterGate;
+  low = HALTimer1Count();
+  high = counterWraps;
+  if (HALTimer1Pending() && low < 0x8000) high++;
+  count = ((uint32_t)high << 16) | low;
+  if (counterPrimed) {
+    counterEdges = count - counterLast;
+    eventPut(EV_COUNT);
+  }
+  counterLast = count;
+  counterPrimed = 1;
+}
+
+// starts continuous counting, EV_COUNT after every gate (ticks), takes timer 1 over
+void EXTCounterStart(uint16_t gate)
+{
+  HALInputInit(HAL_COUNTER);
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    EXTTimer1Start(counterWrap, T1_EXTERNAL, 0xFFFF);
+    counterWraps = 0;
+    counterPrimed = 0;
+    counterTicks = 1;                               // first gate starts with next tick
+    counterGate = gate;
+  }
+}
+
+void EXTCounterStop(void)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    counterGate = 0;
+    EXTTimer1Stop(counterWrap);
+  }
+}
+
+// edges counted within last gate
+uint32_t EXTCounterGet(void)
+{
+  uint32_t edges;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    edges = counterEdges;
+  }
+  return(edges);
 }
+#endif
 
-int8_t EXTRotaryImpulseCheck(void)
+// timer 0 compare match A interrupt routine
+ISR(TIMER0_COMPA_vect)
 {
-  // function returns: -1...knob was turned left, 1...knob was turned right, 0...knob was idle
-  uint8_t ret = 0;
-  if (rotaryImpulseLeft) {
-    ret = -1;
-    rotaryImpulseLeft--;
+  tickCount++;
+  for (uint8_t i = 0; i < EXT_TIMERS; i++) {
+    if (timerTicks[i] && !--timerTicks[i]) eventPut(EV_TIMER + i);
   }
-  else if (rotaryImpulseRight) {
-    ret = 1;
-    rotaryImpulseRight--;
+  buzzerTick();
+  buttonTick();
+#ifdef USE_COUNTER
+  counterTick();
+#endif
+}
+
+//
+// functions handling timer 1 (CTC mode), shared by the signal engines (sweep, modulation, ...)
+// and the frequency counter, only one can own the timer at a time, starting another one takes it over
+//
+static void (*volatile timer1Handler)(void) = 0;
+
+// handler gets called from the compare ISR every (top + 1) timer ticks
+void EXTTimer1Start(void (*handler)(void), uint8_t prescaler, uint16_t top)
+{
+  HALTimer1Stop();
+  timer1Handler = handler;
+  // SPI transactions in main code must not be interrupted by the engine ISRs
+  HALSpiUsingInterrupt();
+  HALTimer1Start(prescaler, top);
+}
+
+// stops timer 1 only if still owned by handler
+void EXTTimer1Stop(void (*handler)(void))
+{
+  if (timer1Handler == handler) {
+    HALTimer1Stop();
+    timer1Handler = 0;
   }
-  return(ret);
+}
+
+uint8_t EXTTimer1Owner(void (*handler)(void))
+{
+  return(timer1Handler == handler);
+}
+
+// timer 1 compare interrupt routine
+ISR(TIMER1_COMPA_vect)
+{
+  timer1Handler();
 }
 
 //
@@ -247,39 +638,189 @@ int8_t EXTRotaryImpulseCheck(void)
 // (the DAC R-2R ladder is used to set the amplification ratio of OpAmp IC6, the output level range
 // is +/- 3V (6Vpp) at maximum, adjusted with R11 at BNC output)
 //
-void EXTDacInit(void)
+// level conversions in fixed point (integer only, no float library needed), the factors are
+// rounded up so that exact ties round up as well, results checked for all levels 0...6.00V
+#if OUTPUT_LEVEL_VPP_MAX != 600
+#error "dacScale[] has been computed for OUTPUT_LEVEL_VPP_MAX 600"
+#endif
+
+// DAC code = round(level * 4095/600 [* 2*sqrt(2) resp. 2*sqrt(3) for Vrms]), factors in Q16
+static const uint32_t dacScale[3] PROGMEM = {
+  447284UL,                               // Vpp
+  1265108UL,                              // Vrms sinus
+  1549435UL                               // Vrms triangle
+};
+// 2*sqrt(2) resp. 2*sqrt(3) in Q20 (Vrms -> Vpp) and their inverse in Q24 (Vpp -> Vrms)
+static const uint32_t rmsToVpp[2] PROGMEM = { 2965821UL, 3632374UL };
+static const uint32_t vppToRms[2] PROGMEM = { 5931642UL, 4843166UL };
+
+// Vrms -> Vpp (adding 0.8 to minimize conversion errors when switching back & forth)
+uint16_t EXTLevelToVpp(uint16_t level, uint8_t waveform)
 {
-  SPI.begin();
+  if (level > OUTPUT_LEVEL_VPP_MAX) level = OUTPUT_LEVEL_VPP_MAX;
+  return((uint16_t)(((uint32_t)level * pgm_read_dword(&rmsToVpp[waveform != SINUS]) + 838861UL) >> 20));
 }
 
-void EXTDacSetLevel(uint16_t outputLevel, uint8_t outputWaveform, uint8_t outputLevelMode)
+// Vpp -> Vrms (truncated)
+uint16_t EXTLevelToVrms(uint16_t level, uint8_t waveform)
 {
-  uint16_t temp1, regist;
-  double temp2;
+  if (level > OUTPUT_LEVEL_VPP_MAX) level = OUTPUT_LEVEL_VPP_MAX;
+  return((uint16_t)(((uint32_t)level * pgm_read_dword(&vppToRms[waveform != SINUS])) >> 24));
+}
+
+static uint16_t dacCode = 0;              // DAC code actually set
+
+// loading a word to the DAC (D15/D14...control bits, D13-D2...data bits, D1/D0...not used))
+static void dacWrite(uint16_t code)
+{
+  HALSpiBegin(AD5452_SPI_CLOCK);
+  HALSpiSelect(HAL_CS_DAC);               // set select signal LOW for DAC AD5452
+  HALSpiWrite16(DAC_WORD(code));
+  HALSpiDeselect(HAL_CS_DAC);             // set select signal HIGH for DAC AD5452
+  HALSpiEnd();
+}
+
+#ifdef USE_FLATNESS
+//
+// amplitude flatness correction: the DAC code gets multiplied by a factor interpolated linearly
+// between FLAT_POINTS calibration points, point n at tuning word 2^(FLAT_OCTAVE0 + n) (octaves),
+// constant below the first & above the last point. Interpolating on the tuning word needs no
+// division, so DDSFreqRaw()/DDSSetup() can correct the level on every retune (also sweep ISR).
+//
+static uint16_t flatFactor[FLAT_POINTS];
+static uint8_t  flatActive = 0;           // any factor not 1.0
+static uint16_t dacBase = 0;              // DAC code without correction
+static uint32_t dacWord = 0;              // tuning word of output frequency
 
-  if (outputLevelMode) {
-    // output level already represents Vpp
-    temp1 = outputLevel;
+// correction factor (Q12) for tuning word, point gets the index of the point below resp. at
+// the tuning word, frac the position towards the next point (0...255)
+static uint16_t flatnessFactor(uint32_t word, uint8_t *point, uint8_t *frac)
+{
+  uint32_t limit = 1UL << (FLAT_OCTAVE0 + FLAT_POINTS - 1);
+  uint32_t diff;
+  uint8_t  n = FLAT_POINTS - 1;
+
+  *frac = 0;
+  if (word < limit) {
+    do {
+      limit >>= 1;
+      n--;
+    } while (n && word < limit);
+    if (word >= limit) {
+      // (word - limit) < 2^(FLAT_OCTAVE0 + n) gets scaled to 8 bits
+      diff = (word - limit) >> (FLAT_OCTAVE0 - 8);
+      for (uint8_t i = n; i; i--) diff >>= 1;
+      *frac = (uint8_t)diff;
+    }
   }
+  *point = n;
+  return(flatFactor[n] + (int16_t)(((int32_t)((int16_t)(flatFactor[n + (*frac != 0)] - flatFactor[n])) * *frac) >> 8));
+}
+
+// DAC code with correction for actual output frequency
+static uint16_t flatnessCode(void)
+{
+  uint8_t  point, frac;
+  uint32_t code;
+
+  if (!flatActive) return(dacBase);
+  code = ((uint32_t)dacBase * flatnessFactor(dacWord, &point, &frac) + (FLAT_ONE / 2)) >> 12;
+  return((code > 0xFFF) ? 0xFFF : (uint16_t)code);
+}
+
+// output frequency changed (called by DDSFreqRaw()/DDSSetup() with interrupts disabled)
+void EXTDacRetune(uint32_t word)
+{
+  uint16_t code;
+
+  dacWord = word;
+  if (!flatActive) return;
+  code = flatnessCode();
+  if (code != dacCode) dacWrite(dacCode = code);
+}
+
+void EXTDacFlatnessSet(uint8_t point, uint16_t factor)
+{
+  if (point >= FLAT_POINTS) return;
+  flatFactor[point] = (factor < FLAT_MIN || factor > FLAT_MAX) ? FLAT_ONE : factor;
+  flatActive = 0;
+  for (uint8_t n = 0; n < FLAT_POINTS; n++) {
+    if (flatFactor[n] != FLAT_ONE) flatActive = 1;
+  }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    dacWrite(dacCode = flatnessCode());
+  }
+}
+
+uint16_t EXTDacFlatnessGet(uint8_t point)
+{
+  return((point < FLAT_POINTS) ? flatFactor[point] : FLAT_ONE);
+}
+
+// frequency of calibration point (rounded up, so the tuning word is at the point)
+uint32_t EXTDacFlatnessFrequency(uint8_t point)
+{
+  return((AD9833_MCLK >> (28 - FLAT_OCTAVE0 - point)) + 1);
+}
+
+// level measured at actual output frequency: the point at resp. above the frequency gets
+// corrected so that the output shows the set level (level & measured in the same unit)
+void EXTDacFlatnessCalibrate(uint16_t level, uint16_t measured)
+{
+  uint8_t  point, frac;
+  uint32_t factor;
+  int32_t  newFactor;
+
+  if (!level || !measured) return;
+  factor = ((uint32_t)flatnessFactor(dacWord, &point, &frac) * level + measured / 2) / measured;
+  if (!frac) newFactor = factor;
   else {
-    // conversion Vrms to Vpp required (adding 0.5 for minimizing conversion error)
-    temp1 = (uint16_t)(((double)outputLevel * 2 * (double)((outputWaveform == SINUS) ? SQRT2 : SQRT3)) + 0.5);
+    // factor = f[point] + (f[point + 1] - f[point]) * frac / 256, solved for f[point + 1]
+    newFactor = flatFactor[point] + (((int32_t)factor - flatFactor[point]) * 256) / frac;
+    point++;
+  }
+  newFactor = (newFactor < FLAT_MIN) ? FLAT_MIN : ((newFactor > FLAT_MAX) ? FLAT_MAX : newFactor);
+  EXTDacFlatnessSet(point, (uint16_t)newFactor);
+}
+#endif
+
+void EXTDacInit(void)
+{
+#ifdef USE_FLATNESS
+  for (uint8_t n = 0; n < FLAT_POINTS; n++) flatFactor[n] = FLAT_ONE;
+#endif
+  HALSpiInit();
+}
+
+void EXTDacSetLevel(uint16_t outputLevel, uint8_t outputWaveform, uint8_t outputLevelMode)
+{
+  uint8_t  scale = outputLevelMode ? 0 : ((outputWaveform == SINUS) ? 1 : 2);
+  uint32_t code;
+
+  // output level (Vpp or Vrms) gets converted into a value between 0 and 4095 (DAC R-2R ladder
+  // setting) in one step, levels beyond 6.00Vpp are limited
+  if (outputLevel > OUTPUT_LEVEL_VPP_MAX) outputLevel = OUTPUT_LEVEL_VPP_MAX;
+  code = ((uint32_t)outputLevel * pgm_read_dword(&dacScale[scale]) + 0x8000UL) >> 16;
+  if (code > 0xFFF) code = 0xFFF;
+#ifdef USE_FLATNESS
+  // the sweep ISR might retune at the same time
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    dacBase = (uint16_t)code;
+    dacWrite(dacCode = flatnessCode());
   }
-  // final check 
-  temp1 = (OUTPUT_LEVEL_VPP_MAX < temp1) ? OUTPUT_LEVEL_VPP_MAX : temp1;
-
-  // at this point temp1 always represents the Vpp output level which must be converted
-  // into a value between 0 and 4095 (DAC R-2R ladder setting)
-  temp2 = ((double)temp1/(double)OUTPUT_LEVEL_VPP_MAX);
-  regist = (uint16_t)(temp2 * (double)0xFFF);
-  regist = regist << 2;
-  regist &= 0x3FFF;                       // clearing control bits C1/C0 in AD5452
-
-  // loading a word to the DAC (D15/D14...control bits, D13-D2...data bits, D1/D0...not used))
-  SPI.beginTransaction(SPI_AD5452);
-  digitalWrite(PIN_AD5452_CS, LOW);       // set select signal LOW for DAC AD5452
-  SPI.transfer((uint8_t)(regist >> 8));
-  SPI.transfer((uint8_t)(regist & 255));
-  digitalWrite(PIN_AD5452_CS, HIGH);      // set select signal HIGH for DAC AD5452
-  SPI.endTransaction();  
+#else
+  dacWrite(dacCode = (uint16_t)code);
+#endif
+}
+
+// DAC code of output level (e.g. as full level of an envelope)
+uint16_t EXTDacCode(void)
+{
+  return(dacCode);
+}
+
+// writes DAC code again (e.g. after an envelope)
+void EXTDacRefresh(void)
+{
+  dacWrite(dacCode);
 }
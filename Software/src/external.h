@@ -28,30 +28,100 @@
 #define V_RMS_MIN_SIN 1
 #define V_RMS_MIN_TRI 1
 
-// for buttons/switches/etc.
-enum buttonEvent { idle = 0, shortPress, longPress, fallingEdge, risingEdge, pressed };
+// timer 1 clock select (F_CPU/8 -> 2MHz, F_CPU/256 -> 62.5kHz)
+#define T1_PRESCALER_8   HAL_T1_PRESCALER_8
+#define T1_PRESCALER_256 HAL_T1_PRESCALER_256
+#define T1_EXTERNAL      HAL_T1_EXTERNAL    // T1 pin (PD5), rising edge
+
+// buzzer patterns
+#define BUZZER_CLICK  0   // 10ms, e.g. limit reached
+#define BUZZER_SINGLE 1   // 80ms, setting confirmed
+#define BUZZER_DOUBLE 2   // 2 x 40ms, sweep confirmed
+#define BUZZER_ERROR  3   // 250ms, invalid setting replaced
+
+// events (EXTEventGet), created by the ISRs of encoder, buttons & 1ms tick
+#define EV_NONE     0
+#define EV_LEFT     1     // encoder turned left by one detent
+#define EV_RIGHT    2     // encoder turned right by one detent
+#define EV_SHORT    3     // encoder button released after short press (<0.5s)
+#define EV_LONG     4     // encoder button released after long press (0.5s-5s)
+#define EV_SELECT   5     // select switch pressed
+#define EV_TIMER    8     // software timer expired (EV_TIMER + timer)
+#define EV_COUNT    16    // frequency counter gate finished (EXTCounterGet)
+
+#define EXT_TIMERS  2     // number of software timers
+
+// ms in ticks of 1.024ms (timer 0 overflow, 1 tick = 128/125 ms), rounded
+#define EXT_MS_TICKS(ms) ((uint16_t)(((uint32_t)(ms) * 125 + 64) / 128))
+
+// frequency counter gate times in ticks of 1.024ms (USE_COUNTER)
+#define COUNTER_GATE      625     // 0.640s, frequency (Hz) = edges * 25 / 16
+#define COUNTER_GATE_CAL  15625   // 16.000s, for MCLK calibration
+
+// AD5452 SPI word of 12bit DAC code (D15/D14...control bits C1/C0 cleared, D13-D2...data bits)
+#define DAC_WORD(code) (((uint16_t)(code) << 2) & 0x3FFF)
+
+// amplitude flatness correction (USE_FLATNESS), factors in Q12
+#define FLAT_POINTS   9     // calibration points at tuning words 2^15...2^23 (3.05kHz...781kHz)
+#define FLAT_OCTAVE0  15
+#define FLAT_ONE      4096  // 1.0
+#define FLAT_MIN      2048  // 0.5
+#define FLAT_MAX      8192  // 2.0
 
 //
 // function declarations
 //
-void EXTDisplayFrequency(uint32_t frequ, uint8_t leadingZeros);
+void     EXTDisplayClear(void);
+void     EXTDisplayCursor(uint8_t col, uint8_t row);
+uint16_t EXTDisplayFlush(void);
+void EXTDisplayFrequency(uint32_t frequ, uint32_t editDigit);
 void EXTDisplayWaveform(uint8_t waveform);
 void EXTDisplayLevel(uint16_t outputLevel,  uint8_t outpuLevelMode);
+void EXTDisplayOutputState(uint8_t enabled);
+void EXTDisplayPreset(uint8_t slot, uint8_t used);
+void EXTDisplaySweep(uint8_t law, uint8_t steps, uint16_t dwell, uint32_t stopFrequ);
+void EXTDisplaySweepState(uint8_t law);
+void EXTDisplayCounter(uint32_t frequ, uint8_t calibrating, uint32_t mclk);
 
 void EXTRelaisInit(void);
 void EXTRelaisOnOff(uint8_t setting);
 
-void EXTBuzzerInit(void);
-void EXTBuzzerRing(uint16_t ms);
+void    EXTBuzzerInit(void);
+void    EXTBuzzerPlay(uint8_t pattern);
+uint8_t EXTBuzzerBusy(void);
 
 void    EXTSelectSwitchInit(void);
-uint8_t EXTSelectSwitchCheck(void);
 
-void        EXTRotaryInit(void);
-buttonEvent EXTRotaryButtonCheck(void);
-int8_t      EXTRotaryImpulseCheck(void);
+void    EXTRotaryInit(void);
+uint8_t EXTRotaryButtonPressed(void);
+uint8_t EXTRotaryAcceleration(void);
+
+uint8_t EXTEventGet(void);
+void    EXTEventFlush(void);
+void    EXTEventWait(void);
+void    EXTTimerStart(uint8_t timer, uint16_t ms);
+void    EXTTimerStop(uint8_t timer);
+
+void    EXTTickInit(void);
+
+void    EXTTimer1Start(void (*handler)(void), uint8_t prescaler, uint16_t top);
+void    EXTTimer1Stop(void (*handler)(void));
+uint8_t EXTTimer1Owner(void (*handler)(void));
+
+void     EXTCounterStart(uint16_t gate);
+void     EXTCounterStop(void);
+uint32_t EXTCounterGet(void);
 
-void EXTDacInit(void);
+uint16_t EXTLevelToVpp(uint16_t level, uint8_t waveform);
+uint16_t EXTLevelToVrms(uint16_t level, uint8_t waveform);
+void     EXTDacRetune(uint32_t word);
+void     EXTDacFlatnessSet(uint8_t point, uint16_t factor);
+uint16_t EXTDacFlatnessGet(uint8_t point);
+uint32_t EXTDacFlatnessFrequency(uint8_t point);
+void     EXTDacFlatnessCalibrate(uint16_t level, uint16_t measured);
+void     EXTDacInit(void);
+uint16_t EXTDacCode(void);
+void     EXTDacRefresh(void);
 void EXTDacSetLevel(uint16_t outputLevel, uint8_t outputWaveform, uint8_t outputLevelMode);
 
 #endif
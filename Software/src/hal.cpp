@@ -0,0 +1,20 @@
+/*
+ * HAL.CPP: objects of the hardware abstraction layer used by its inline functions (Atmega168)
+*/
+
+#include "hal.h"
+
+#ifndef HAL_NATIVE
+
+LiquidCrystal_I2C lcd(0x27,16,2); // set the LCD I2C address, 16 cols, 2 rows
+
+#ifdef USE_BENCH
+volatile uint16_t halCycleOverflows;
+
+ISR(TIMER1_OVF_vect)
+{
+  halCycleOverflows++;
+}
+#endif
+
+#endif
@@ -0,0 +1,477 @@
+/*
+ * HAL.H: thin hardware abstraction layer for the AD9833 function generator
+ *
+ * The drivers and main.cpp access SPI, port pins, timers, EEPROM, the watchdog and the LCD only
+ * through these functions and include no Arduino, library or avr-libc header themselves.
+ * On the Atmega168 the functions are inline and compile to the same direct register accesses
+ * (sbi/cbi) and library calls as before. With HAL_NATIVE (PlatformIO [env:native]) they are
+ * replaced by the recording fakes of hal_native.h, which also provide Serial/F(), PROGMEM,
+ * ISR() and ATOMIC_BLOCK() of the Arduino core & avr-libc for the host.
+*/
+
+#ifndef HAL_H_
+#define HAL_H_
+
+// SPI chip selects at PORTB (active low)
+#define HAL_CS_DAC    (1 << 1)        // PB1: DAC AD5452
+#define HAL_CS_DDS    (1 << 2)        // PB2: FSYNC of AD9833 (PIN_SPI_SS)
+#define HAL_CS_DDS1   (1 << 2)        // PC2: FSYNC of further AD9833 modules (DDS_CHANNELS > 1)
+#define HAL_CS_DDS2   (1 << 3)        // PC3
+#define HAL_CS_DDS3   (1 << 6)        // PD6
+
+// outputs
+#define HAL_RELAIS    (1 << 0)        // PB0
+#define HAL_BUZZER    (1 << 0)        // PC0
+
+// inputs at PORTD (pull-ups, low active)
+#define HAL_ENCODER_A (1 << 2)        // PD2
+#define HAL_ENCODER_B (1 << 3)        // PD3
+#define HAL_ENCODER_SHIFT  2          // encoder BA state at bit 1/0 after shifting
+#define HAL_BUTTON_ENCODER (1 << 4)   // PD4
+#define HAL_BUTTON_SELECT  (1 << 7)   // PD7
+#define HAL_COUNTER   (1 << 5)        // PD5: frequency counter input T1 (timer 1 clock)
+
+// burst trigger input at PORTC (pull-up, falling edge)
+#define HAL_TRIGGER   (1 << 1)        // PC1
+
+// timer 1 clock select (CS12...CS10)
+#define HAL_T1_PRESCALER_8   2        // F_CPU/8 -> 2MHz
+#define HAL_T1_PRESCALER_256 4        // F_CPU/256 -> 62.5kHz
+#define HAL_T1_EXTERNAL      7        // T1 pin (PD5), rising edge
+
+#ifdef HAL_NATIVE
+#include "hal_native.h"
+#else
+
+#include <Arduino.h>
+#include <SPI.h>
+#include <Wire.h>
+#include <LiquidCrystal_I2C.h>
+#include <util/atomic.h>
+#include <util/crc16.h>
+#include <avr/eeprom.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+
+extern LiquidCrystal_I2C lcd;
+
+//
+// SPI
+//
+// both chip selects high & output, SPI SS pin (AD9833 FSYNC) gets set by SPI.begin()
+static inline void HALSpiInit(void)
+{
+  PORTB |= HAL_CS_DAC;
+  DDRB |= HAL_CS_DAC;
+  SPI.begin();
+}
+
+// all devices on the bus (AD9833, AD5452) use SPI mode 2, MSB first, only the clock differs
+static inline void HALSpiBegin(uint32_t clock)
+{
+  SPI.beginTransaction(SPISettings(clock, MSBFIRST, SPI_MODE2));
+}
+
+static inline void HALSpiEnd(void)
+{
+  SPI.endTransaction();
+}
+
+static inline void HALSpiSelect(uint8_t cs)
+{
+  PORTB &= ~cs;
+}
+
+static inline void HALSpiDeselect(uint8_t cs)
+{
+  PORTB |= cs;
+}
+
+// FSYNC of AD9833 channels (bit n...channel n), channel 0 is set up by SPI.begin(),
+// the others get high & output
+static inline void HALDdsInit(uint8_t channels)
+{
+  if (channels & 2) { PORTC |= HAL_CS_DDS1; DDRC |= HAL_CS_DDS1; }
+  if (channels & 4) { PORTC |= HAL_CS_DDS2; DDRC |= HAL_CS_DDS2; }
+  if (channels & 8) { PORTD |= HAL_CS_DDS3; DDRD |= HAL_CS_DDS3; }
+}
+
+// all channels selected at once (a constant single channel compiles to one cbi/sbi)
+static inline void HALDdsSelect(uint8_t channels)
+{
+  if (channels & 1) PORTB &= ~HAL_CS_DDS;
+  if (channels & 2) PORTC &= ~HAL_CS_DDS1;
+  if (channels & 4) PORTC &= ~HAL_CS_DDS2;
+  if (channels & 8) PORTD &= ~HAL_CS_DDS3;
+}
+
+static inline void HALDdsDeselect(uint8_t channels)
+{
+  if (channels & 1) PORTB |= HAL_CS_DDS;
+  if (channels & 2) PORTC |= HAL_CS_DDS1;
+  if (channels & 4) PORTC |= HAL_CS_DDS2;
+  if (channels & 8) PORTD |= HAL_CS_DDS3;
+}
+
+// 16bit word, high byte first
+static inline void HALSpiWrite16(uint16_t data)
+{
+  SPI.transfer((uint8_t)(data >> 8));
+  SPI.transfer((uint8_t)(data & 255));
+}
+
+// SPI transactions get protected against interrupts (SPI used in ISRs)
+static inline void HALSpiUsingInterrupt(void)
+{
+  SPI.usingInterrupt(255);
+}
+
+//
+// port pins
+//
+static inline void HALRelaisInit(void)
+{
+  PORTB &= ~HAL_RELAIS;
+  DDRB |= HAL_RELAIS;
+}
+
+static inline void HALRelais(uint8_t on)
+{
+  if (on) PORTB |= HAL_RELAIS;
+  else PORTB &= ~HAL_RELAIS;
+}
+
+static inline void HALBuzzerInit(void)
+{
+  PORTC &= ~HAL_BUZZER;
+  DDRC |= HAL_BUZZER;
+}
+
+static inline void HALBuzzer(uint8_t on)
+{
+  if (on) PORTC |= HAL_BUZZER;
+  else PORTC &= ~HAL_BUZZER;
+}
+
+// inputs with pull-up
+static inline void HALInputInit(uint8_t mask)
+{
+  DDRD &= ~mask;
+  PORTD |= mask;
+}
+
+static inline uint8_t HALInputs(void)
+{
+  return(PIND);
+}
+
+// pin change interrupt (PCINT2_vect) on both encoder signals
+static inline void HALEncoderIrqInit(void)
+{
+  PCMSK2 |= (1 << PCINT18) | (1 << PCINT19);
+  PCIFR = (1 << PCIF2);
+  PCICR |= (1 << PCIE2);
+}
+
+// trigger input with pull-up, pin change interrupt (PCINT1_vect) only enabled by HALTriggerIrq()
+static inline void HALTriggerInit(void)
+{
+  DDRC &= ~HAL_TRIGGER;
+  PORTC |= HAL_TRIGGER;
+  PCMSK1 |= (1 << PCINT9);
+}
+
+static inline void HALTriggerIrq(uint8_t on)
+{
+  if (on) {
+    PCIFR = (1 << PCIF1);
+    PCICR |= (1 << PCIE1);
+  }
+  else PCICR &= ~(1 << PCIE1);
+}
+
+// trigger input active (low)
+static inline uint8_t HALTrigger(void)
+{
+  return(!(PINC & HAL_TRIGGER));
+}
+
+//
+// timers
+//
+// 1ms tick: timer 0 (millis() of Arduino core) compare match A (TIMER0_COMPA_vect)
+static inline void HALTickInit(void)
+{
+  OCR0A = 0x80;
+  TIFR0 = (1 << OCF0A);
+  TIMSK0 |= (1 << OCIE0A);
+}
+
+// timer 1 in CTC mode, compare interrupt (TIMER1_COMPA_vect) every (top + 1) timer ticks
+static inline void HALTimer1Start(uint8_t prescaler, uint16_t top)
+{
+  TIMSK1 &= ~(1 << OCIE1A);
+  TCCR1A = 0;
+  TCCR1B = (1 << WGM12) | prescaler;
+  OCR1A = top;
+  TCNT1 = 0;
+  TIFR1 = (1 << OCF1A);
+  TIMSK1 |= (1 << OCIE1A);
+}
+
+static inline void HALTimer1Stop(void)
+{
+  TIMSK1 &= ~(1 << OCIE1A);
+}
+
+// new top for the running period (called from compare ISR, the counter has just been cleared)
+static inline void HALTimer1Top(uint16_t top)
+{
+  OCR1A = top;
+}
+
+// actual count & pending compare match (e.g. counting external clock at T1)
+static inline uint16_t HALTimer1Count(void)
+{
+  return(TCNT1);
+}
+
+static inline uint8_t HALTimer1Pending(void)
+{
+  return(TIFR1 & (1 << OCF1A));
+}
+
+// restarts counting from 0 with new top, interrupt stays enabled
+static inline void HALTimer1Restart(uint16_t top)
+{
+  TCNT1 = 0;
+  OCR1A = top;
+  TIFR1 = (1 << OCF1A);
+}
+
+//
+// EEPROM ready interrupt (EE_READY_vect)
+//
+static inline void HALEepromIrq(uint8_t on)
+{
+  if (on) EECR |= (1 << EERIE);
+  else EECR &= ~(1 << EERIE);
+}
+
+//
+// EEPROM contents (avr-libc), addresses are EEMEM variables
+//
+static inline void HALEepromWait(void)
+{
+  eeprom_busy_wait();
+}
+
+static inline uint8_t HALEepromReady(void)
+{
+  return(eeprom_is_ready());
+}
+
+static inline uint8_t HALEepromReadByte(const uint8_t *address)
+{
+  return(eeprom_read_byte(address));
+}
+
+static inline uint16_t HALEepromReadWord(const uint16_t *address)
+{
+  return(eeprom_read_word(address));
+}
+
+static inline uint32_t HALEepromReadDword(const uint32_t *address)
+{
+  return(eeprom_read_dword(address));
+}
+
+static inline void HALEepromReadBlock(void *data, const void *address, size_t size)
+{
+  eeprom_read_block(data, address, size);
+}
+
+// starts writing one byte (EEPROM ready interrupt or HALEepromWait() signal completion)
+static inline void HALEepromWriteByte(uint8_t *address, uint8_t data)
+{
+  eeprom_write_byte(address, data);
+}
+
+// writes only the bytes differing from the EEPROM contents (blocking)
+static inline void HALEepromUpdateByte(uint8_t *address, uint8_t data)
+{
+  eeprom_update_byte(address, data);
+}
+
+static inline void HALEepromUpdateWord(uint16_t *address, uint16_t data)
+{
+  eeprom_update_word(address, data);
+}
+
+static inline void HALEepromUpdateDword(uint32_t *address, uint32_t data)
+{
+  eeprom_update_dword(address, data);
+}
+
+static inline void HALEepromUpdateBlock(const void *data, void *address, size_t size)
+{
+  eeprom_update_block(data, address, size);
+}
+
+// CRC8 (CCITT polynom 0x07) of one more byte
+static inline uint8_t HALCrc8(uint8_t crc, uint8_t data)
+{
+  return(_crc8_ccitt_update(crc, data));
+}
+
+//
+// time, sleep & watchdog
+//
+// us since power on (4us resolution, timer 0 of the Arduino core)
+static inline uint32_t HALMicros(void)
+{
+  return(micros());
+}
+
+static inline void HALDelay(uint16_t ms)
+{
+  delay(ms);
+}
+
+static inline void HALIrqDisable(void)
+{
+  cli();
+}
+
+static inline void HALIrqEnable(void)
+{
+  sei();
+}
+
+// idle sleep until the next interrupt (timers keep running), to be called with interrupts
+// disabled, returns with interrupts enabled (no interrupt gets lost in between)
+static inline void HALSleep(void)
+{
+#ifdef USE_BENCH
+  sei();                                  // bench firmware: loop() passes get counted without sleeping
+#else
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  sleep_enable();
+  sei();                                  // next instruction still gets executed
+  sleep_cpu();
+  sleep_disable();
+#endif
+}
+
+// watchdog timeout 4s, interrupt (WDT_vect) first, reset at the next timeout
+static inline void HALWatchdogStart(void)
+{
+  wdt_enable(WDTO_4S);
+  WDTCSR |= (1 << WDIE);
+  wdt_reset();
+}
+
+static inline void HALWatchdogReset(void)
+{
+  wdt_reset();
+}
+
+// reset right now (called from WDT_vect)
+static inline void HALWatchdogReboot(void)
+{
+  wdt_enable(WDTO_15MS);
+  while (1);
+}
+
+#ifdef USE_BENCH
+//
+// bench firmware: CPU cycles counted by timer 1 (prescaler 1) and its overflow interrupt,
+// both timer 0 interrupts (1ms tick & millis() of the Arduino core) are held off while
+// counting, so the counts don't depend on the timer 0 phase
+//
+extern volatile uint16_t halCycleOverflows;
+
+static inline void HALCycleStart(void)
+{
+  TIMSK0 &= ~((1 << OCIE0A) | (1 << TOIE0));
+  TCCR1B = 0;
+  TCCR1A = 0;
+  TCNT1 = 0;
+  halCycleOverflows = 0;
+  TIFR1 = (1 << TOV1);
+  TIMSK1 = (1 << TOIE1);
+  TCCR1B = (1 << CS10);
+}
+
+static inline uint32_t HALCycleStop(void)
+{
+  uint16_t count;
+
+  TCCR1B = 0;
+  count = TCNT1;
+  cli();
+  if (TIFR1 & (1 << TOV1)) {              // overflow not yet serviced
+    TIFR1 = (1 << TOV1);
+    halCycleOverflows++;
+  }
+  TIMSK1 = 0;
+  sei();
+  TIMSK0 |= (1 << OCIE0A) | (1 << TOIE0);
+  return(((uint32_t)halCycleOverflows << 16) | count);
+}
+
+// sleeping with interrupts off ends the simulation (simavr)
+static inline void HALHalt(void)
+{
+  cli();
+  sleep_enable();
+  sleep_cpu();
+}
+#endif
+
+//
+// LCD 16x2 (I2C)
+//
+static inline void HALLcdInit(void)
+{
+  lcd.init();
+  lcd.backlight();
+}
+
+static inline void HALLcdClear(void)
+{
+  lcd.clear();
+}
+
+static inline void HALLcdGoto(uint8_t col, uint8_t row)
+{
+  lcd.setCursor(col, row);
+}
+
+static inline void HALLcdWrite(char c)
+{
+  lcd.write(c);
+}
+
+static inline void HALLcdText(const char *text)
+{
+  lcd.print(text);
+}
+
+// underline cursor on/off
+static inline void HALLcdCursor(uint8_t on)
+{
+  if (on) lcd.cursor();
+  else lcd.noCursor();
+}
+
+// blinking cursor on/off
+static inline void HALLcdBlink(uint8_t on)
+{
+  if (on) lcd.blink();
+  else lcd.noBlink();
+}
+
+#endif   // HAL_NATIVE
+
+#endif
@@ -0,0 +1,451 @@
+/*
+ * HAL_NATIVE.CPP: host backend of the hardware abstraction layer (HAL_NATIVE, [env:native])
+ *
+ * Only the state the tests look at is modelled: SPI words with their chip selects, pin levels,
+ * timer 1 registers, EEPROM contents & write count, LCD characters and serial output.
+ * Nothing happens by itself, a test simulates interrupts by calling the ISR functions.
+*/
+
+#include "hal.h"
+
+#ifdef HAL_NATIVE
+
+#include <stdio.h>
+
+halFakeState  halFake;
+halFakeSerial Serial;
+
+// EEMEM variables (section haleeprom), start & end provided by the GNU linker
+extern uint8_t __start_haleeprom[];
+extern uint8_t __stop_haleeprom[];
+
+// power on: EEPROM erased, no SPI word written, inputs pulled up, LCD blank
+void HALFakeReset(void)
+{
+  memset(&halFake, 0, sizeof(halFake));
+  halFake.inputs = 0xFF;
+  memset(halFake.lcd, ' ', sizeof(halFake.lcd));
+  memset(__start_haleeprom, 0xFF, __stop_haleeprom - __start_haleeprom);
+}
+
+void HALFakeSpiClear(void)
+{
+  halFake.spiCount = 0;
+}
+
+void HALFakeSerialClear(void)
+{
+  halFake.serialLength = 0;
+  halFake.serialOut[0] = 0;
+}
+
+// one LCD row as 0 terminated string (text needs 17 chars)
+void HALFakeLcdRow(uint8_t row, char *text)
+{
+  memcpy(text, halFake.lcd[row & 1], 16);
+  text[16] = 0;
+}
+
+//
+// SPI
+//
+void HALSpiInit(void)
+{
+}
+
+void HALSpiBegin(uint32_t clock)
+{
+  halFake.spiClock = clock;
+  halFake.spiTransaction = ++halFake.spiTransactions;
+  if (!halFake.spiTransaction) halFake.spiTransaction = halFake.spiTransactions = 1;
+}
+
+void HALSpiEnd(void)
+{
+  halFake.spiTransaction = 0;
+}
+
+// chip selects at PORTB: DAC & AD9833 channel 0
+void HALSpiSelect(uint8_t cs)
+{
+  if (cs & HAL_CS_DAC) halFake.select |= HAL_FAKE_DAC;
+  if (cs & HAL_CS_DDS) halFake.select |= 1;
+}
+
+void HALSpiDeselect(uint8_t cs)
+{
+  if (cs & HAL_CS_DAC) halFake.select &= ~HAL_FAKE_DAC;
+  if (cs & HAL_CS_DDS) halFake.select &= ~1;
+}
+
+void HALDdsInit(uint8_t channels)
+{
+  halFake.select &= ~channels;
+}
+
+void HALDdsSelect(uint8_t channels)
+{
+  halFake.select |= channels & 0x0F;
+}
+
+void HALDdsDeselect(uint8_t channels)
+{
+  halFake.select &= ~(channels & 0x0F);
+}
+
+void HALSpiWrite16(uint16_t data)
+{
+  if (halFake.spiCount < HAL_FAKE_SPI_WORDS) {
+    halSpiWord *word = &halFake.spi[halFake.spiCount];
+    word->data = data;
+    word->select = halFake.select;
+    word->transaction = halFake.spiTransaction;
+  }
+  halFake.spiCount++;
+}
+
+void HALSpiUsingInterrupt(void)
+{
+}
+
+//
+// port pins
+//
+void HALRelaisInit(void)
+{
+  halFake.relais = 0;
+}
+
+void HALRelais(uint8_t on)
+{
+  halFake.relais = on;
+}
+
+void HALBuzzerInit(void)
+{
+  halFake.buzzer = 0;
+}
+
+void HALBuzzer(uint8_t on)
+{
+  halFake.buzzer = on;
+}
+
+void HALInputInit(uint8_t mask)
+{
+  (void)mask;
+}
+
+uint8_t HALInputs(void)
+{
+  return(halFake.inputs);
+}
+
+void HALEncoderIrqInit(void)
+{
+}
+
+void HALTriggerInit(void)
+{
+}
+
+void HALTriggerIrq(uint8_t on)
+{
+  halFake.triggerIrq = on;
+}
+
+uint8_t HALTrigger(void)
+{
+  return(halFake.trigger);
+}
+
+//
+// timers
+//
+void HALTickInit(void)
+{
+}
+
+void HALTimer1Start(uint8_t prescaler, uint16_t top)
+{
+  halFake.timer1.prescaler = prescaler;
+  halFake.timer1.top = top;
+  halFake.timer1.count = 0;
+  halFake.timer1.pending = 0;
+  halFake.timer1.irq = 1;
+}
+
+void HALTimer1Stop(void)
+{
+  halFake.timer1.irq = 0;
+}
+
+void HALTimer1Top(uint16_t top)
+{
+  halFake.timer1.top = top;
+}
+
+uint16_t HALTimer1Count(void)
+{
+  return(halFake.timer1.count);
+}
+
+uint8_t HALTimer1Pending(void)
+{
+  return(halFake.timer1.pending);
+}
+
+void HALTimer1Restart(uint16_t top)
+{
+  halFake.timer1.count = 0;
+  halFake.timer1.top = top;
+  halFake.timer1.pending = 0;
+}
+
+//
+// EEPROM: every write completes at once
+//
+void HALEepromIrq(uint8_t on)
+{
+  halFake.eepromIrq = on;
+}
+
+void HALEepromWait(void)
+{
+}
+
+uint8_t HALEepromReady(void)
+{
+  return(1);
+}
+
+uint8_t HALEepromReadByte(const uint8_t *address)
+{
+  return(*address);
+}
+
+uint16_t HALEepromReadWord(const uint16_t *address)
+{
+  uint16_t data;
+
+  memcpy(&data, address, sizeof(data));
+  return(data);
+}
+
+uint32_t HALEepromReadDword(const uint32_t *address)
+{
+  uint32_t data;
+
+  memcpy(&data, address, sizeof(data));
+  return(data);
+}
+
+void HALEepromReadBlock(void *data, const void *address, size_t size)
+{
+  memcpy(data, address, size);
+}
+
+void HALEepromWriteByte(uint8_t *address, uint8_t data)
+{
+  *address = data;
+  halFake.eepromWrites++;
+}
+
+void HALEepromUpdateBlock(const void *data, void *address, size_t size)
+{
+  const uint8_t *src = (const uint8_t *)data;
+  uint8_t *dst = (uint8_t *)address;
+
+  for (size_t i = 0; i < size; i++) {
+    if (dst[i] != src[i]) HALEepromWriteByte(&dst[i], src[i]);
+  }
+}
+
+void HALEepromUpdateByte(uint8_t *address, uint8_t data)
+{
+  HALEepromUpdateBlock(&data, address, sizeof(data));
+}
+
+void HALEepromUpdateWord(uint16_t *address, uint16_t data)
+{
+  HALEepromUpdateBlock(&data, address, sizeof(data));
+}
+
+void HALEepromUpdateDword(uint32_t *address, uint32_t data)
+{
+  HALEepromUpdateBlock(&data, address, sizeof(data));
+}
+
+// same as _crc8_ccitt_update() of avr-libc
+uint8_t HALCrc8(uint8_t crc, uint8_t data)
+{
+  crc ^= data;
+  for (uint8_t i = 0; i < 8; i++) crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+  return(crc);
+}
+
+//
+// time, sleep & watchdog
+//
+uint32_t HALMicros(void)
+{
+  return(halFake.micros);
+}
+
+void HALDelay(uint16_t ms)
+{
+  halFake.micros += ms * 1000UL;
+}
+
+void HALIrqDisable(void)
+{
+  halFake.irqDisabled = 1;
+}
+
+void HALIrqEnable(void)
+{
+  halFake.irqDisabled = 0;
+}
+
+// returns at once, as if woken up by the next tick
+void HALSleep(void)
+{
+  halFake.sleeps++;
+  halFake.irqDisabled = 0;
+}
+
+void HALWatchdogStart(void)
+{
+  halFake.watchdog = 1;
+}
+
+void HALWatchdogReset(void)
+{
+}
+
+void HALWatchdogReboot(void)
+{
+  halFake.watchdog = 2;
+}
+
+//
+// LCD
+//
+void HALLcdInit(void)
+{
+  HALLcdClear();
+}
+
+void HALLcdClear(void)
+{
+  memset(halFake.lcd, ' ', sizeof(halFake.lcd));
+  halFake.lcdCol = halFake.lcdRow = 0;
+  halFake.lcdBytes++;
+}
+
+void HALLcdGoto(uint8_t col, uint8_t row)
+{
+  halFake.lcdCol = col;
+  halFake.lcdRow = row & 1;
+  halFake.lcdBytes++;
+}
+
+void HALLcdWrite(char c)
+{
+  if (halFake.lcdCol < 16) halFake.lcd[halFake.lcdRow][halFake.lcdCol++] = c;
+  halFake.lcdBytes++;
+}
+
+void HALLcdText(const char *text)
+{
+  while (*text) HALLcdWrite(*text++);
+}
+
+void HALLcdCursor(uint8_t on)
+{
+  halFake.lcdCursor = on;
+}
+
+void HALLcdBlink(uint8_t on)
+{
+  halFake.lcdBlink = on;
+}
+
+//
+// serial port
+//
+static void serialPut(const char *text)
+{
+  while (*text && halFake.serialLength < HAL_FAKE_SERIAL - 1) halFake.serialOut[halFake.serialLength++] = *text++;
+  halFake.serialOut[halFake.serialLength] = 0;
+}
+
+void halFakeSerial::begin(unsigned long baud)
+{
+  (void)baud;
+}
+
+int halFakeSerial::available(void)
+{
+  return((halFake.serialIn && *halFake.serialIn) ? (int)strlen(halFake.serialIn) : 0);
+}
+
+int halFakeSerial::read(void)
+{
+  return(available() ? (uint8_t)*halFake.serialIn++ : -1);
+}
+
+void halFakeSerial::print(const char *text)
+{
+  serialPut(text);
+}
+
+void halFakeSerial::print(const __FlashStringHelper *text)
+{
+  serialPut(reinterpret_cast<const char *>(text));
+}
+
+void halFakeSerial::print(char c)
+{
+  char text[2] = { c, 0 };
+
+  serialPut(text);
+}
+
+void halFakeSerial::print(unsigned char number)
+{
+  print((unsigned long)number);
+}
+
+void halFakeSerial::print(int number)
+{
+  print((long)number);
+}
+
+void halFakeSerial::print(unsigned int number)
+{
+  print((unsigned long)number);
+}
+
+void halFakeSerial::print(long number)
+{
+  char text[12];
+
+  snprintf(text, sizeof(text), "%ld", number);
+  serialPut(text);
+}
+
+void halFakeSerial::print(unsigned long number)
+{
+  char text[12];
+
+  snprintf(text, sizeof(text), "%lu", number);
+  serialPut(text);
+}
+
+void halFakeSerial::println(void)
+{
+  serialPut("\r\n");
+}
+
+#endif
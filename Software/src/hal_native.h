@@ -0,0 +1,187 @@
+/*
+ * HAL_NATIVE.H: host backend of the hardware abstraction layer (HAL_NATIVE, [env:native])
+ *
+ * Recording fakes instead of hardware: every SPI word is logged with the chip selects low at
+ * that time, port pins, timer 1, the watchdog and the LCD are kept as plain state in halFake,
+ * the EEMEM variables live in RAM (erased to 0xFF by HALFakeReset()) and micros() only advances
+ * when a test or HALDelay() moves it. Interrupt routines become plain functions which the tests
+ * call to simulate an interrupt. Also provides the parts of the Arduino core & avr-libc used by
+ * the sources (Serial, F(), PROGMEM, ISR(), ATOMIC_BLOCK()), so they compile unchanged.
+*/
+
+#ifndef HAL_NATIVE_H_
+#define HAL_NATIVE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <ctype.h>
+
+// avr-libc replacements: flash & EEPROM are plain memory, interrupts are never nested
+#define PROGMEM
+#define pgm_read_byte(address)  (*(const uint8_t *)(address))
+#define pgm_read_word(address)  (*(const uint16_t *)(address))
+#define pgm_read_dword(address) (*(const uint32_t *)(address))
+#define pgm_read_ptr(address)   (*(void * const *)(address))
+#define EEMEM                   __attribute__((section("haleeprom")))
+#define ATOMIC_RESTORESTATE     0
+#define ATOMIC_BLOCK(type)      for (uint8_t halAtomic = 1; halAtomic; halAtomic = 0)
+#define ISR(vector)             void vector(void)
+
+// interrupt routines a test can call
+void PCINT1_vect(void);
+void PCINT2_vect(void);
+void TIMER0_COMPA_vect(void);
+void TIMER1_COMPA_vect(void);
+void EE_READY_vect(void);
+void WDT_vect(void);
+
+// Arduino sketch
+void setup(void);
+void loop(void);
+
+// fake state
+#define HAL_FAKE_SPI_WORDS  512
+#define HAL_FAKE_SERIAL     512
+#define HAL_FAKE_DAC        0x10    // select bit of the DAC, bit n...AD9833 channel n
+
+struct halSpiWord {
+  uint16_t data;
+  uint8_t  select;                  // chip selects low while written
+  uint8_t  transaction;             // number of the SPI transaction, 0...bare write (ISR)
+};
+
+struct halFakeState {
+  halSpiWord spi[HAL_FAKE_SPI_WORDS];
+  uint16_t   spiCount;              // words written (only the first HAL_FAKE_SPI_WORDS logged)
+  uint8_t    spiTransactions;
+  uint8_t    spiTransaction;        // actual transaction, 0 outside
+  uint32_t   spiClock;
+  uint8_t    select;                // chip selects actually low
+  uint8_t    relais;
+  uint8_t    buzzer;
+  uint8_t    inputs;                // PORTD pins, pull-ups high
+  uint8_t    trigger;               // trigger input low
+  uint8_t    triggerIrq;
+  uint8_t    eepromIrq;
+  uint8_t    irqDisabled;
+  struct {
+    uint8_t  prescaler;
+    uint16_t top;
+    uint16_t count;
+    uint8_t  irq;
+    uint8_t  pending;
+  } timer1;
+  uint32_t   micros;
+  uint16_t   sleeps;
+  uint8_t    watchdog;              // 1...running, 2...reboot requested
+  uint16_t   eepromWrites;          // bytes actually written
+  char       lcd[2][16];
+  uint8_t    lcdCol;
+  uint8_t    lcdRow;
+  uint8_t    lcdCursor;
+  uint8_t    lcdBlink;
+  uint16_t   lcdBytes;              // characters & commands sent to the LCD
+  char       serialOut[HAL_FAKE_SERIAL];
+  uint16_t   serialLength;
+  const char *serialIn;             // input not yet read
+};
+
+extern halFakeState halFake;
+
+void HALFakeReset(void);
+void HALFakeSpiClear(void);
+void HALFakeSerialClear(void);
+void HALFakeLcdRow(uint8_t row, char *text);
+
+// SPI
+void HALSpiInit(void);
+void HALSpiBegin(uint32_t clock);
+void HALSpiEnd(void);
+void HALSpiSelect(uint8_t cs);
+void HALSpiDeselect(uint8_t cs);
+void HALDdsInit(uint8_t channels);
+void HALDdsSelect(uint8_t channels);
+void HALDdsDeselect(uint8_t channels);
+void HALSpiWrite16(uint16_t data);
+void HALSpiUsingInterrupt(void);
+
+// port pins
+void    HALRelaisInit(void);
+void    HALRelais(uint8_t on);
+void    HALBuzzerInit(void);
+void    HALBuzzer(uint8_t on);
+void    HALInputInit(uint8_t mask);
+uint8_t HALInputs(void);
+void    HALEncoderIrqInit(void);
+void    HALTriggerInit(void);
+void    HALTriggerIrq(uint8_t on);
+uint8_t HALTrigger(void);
+
+// timers
+void     HALTickInit(void);
+void     HALTimer1Start(uint8_t prescaler, uint16_t top);
+void     HALTimer1Stop(void);
+void     HALTimer1Top(uint16_t top);
+uint16_t HALTimer1Count(void);
+uint8_t  HALTimer1Pending(void);
+void     HALTimer1Restart(uint16_t top);
+
+// EEPROM
+void     HALEepromIrq(uint8_t on);
+void     HALEepromWait(void);
+uint8_t  HALEepromReady(void);
+uint8_t  HALEepromReadByte(const uint8_t *address);
+uint16_t HALEepromReadWord(const uint16_t *address);
+uint32_t HALEepromReadDword(const uint32_t *address);
+void     HALEepromReadBlock(void *data, const void *address, size_t size);
+void     HALEepromWriteByte(uint8_t *address, uint8_t data);
+void     HALEepromUpdateByte(uint8_t *address, uint8_t data);
+void     HALEepromUpdateWord(uint16_t *address, uint16_t data);
+void     HALEepromUpdateDword(uint32_t *address, uint32_t data);
+void     HALEepromUpdateBlock(const void *data, void *address, size_t size);
+uint8_t  HALCrc8(uint8_t crc, uint8_t data);
+
+// time, sleep & watchdog
+uint32_t HALMicros(void);
+void     HALDelay(uint16_t ms);
+void     HALIrqDisable(void);
+void     HALIrqEnable(void);
+void     HALSleep(void);
+void     HALWatchdogStart(void);
+void     HALWatchdogReset(void);
+void     HALWatchdogReboot(void);
+
+// LCD
+void HALLcdInit(void);
+void HALLcdClear(void);
+void HALLcdGoto(uint8_t col, uint8_t row);
+void HALLcdWrite(char c);
+void HALLcdText(const char *text);
+void HALLcdCursor(uint8_t on);
+void HALLcdBlink(uint8_t on);
+
+// serial port: Print interface of the Arduino core, output recorded, input from halFake.serialIn
+class __FlashStringHelper;
+#define F(text) (reinterpret_cast<const __FlashStringHelper *>(text))
+
+class halFakeSerial {
+public:
+  void begin(unsigned long baud);
+  int  available(void);
+  int  read(void);
+  void print(const char *text);
+  void print(const __FlashStringHelper *text);
+  void print(char c);
+  void print(unsigned char number);
+  void print(int number);
+  void print(unsigned int number);
+  void print(long number);
+  void print(unsigned long number);
+  template <typename T> void println(T value) { print(value); println(); }
+  void println(void);
+};
+
+extern halFakeSerial Serial;
+
+#endif
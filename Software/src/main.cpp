@@ -16,33 +16,63 @@
 
 ******************************************************************************/
 
-#include <Arduino.h>
-#include <SPI.h>
-#include <Wire.h> 
-#include <LiquidCrystal_I2C.h>
-#include <avr/wdt.h> 
+#include "config.h"
+#include "hal.h"
 #include "ad9833.h"
 #include "external.h"
-
-#define USE_WDT           // uncomment for using watchdog
-//#define USE_SERIAL        // uncomment for using serial output
+#include "sweep.h"
+#include "modulation.h"
+#include "envelope.h"
+#include "burst.h"
+#include "persist.h"
+#include "probe.h"
+#include "bench.h"
 
 // some configurable definitions
 #define MAX_IDLE_TIME 30      // 30 sec
 #define MAX_FREQ      500000  // 500kHz for sinus/triangle
 #define MAX_FREQ_TTL  5000000 // 5.0MHz for TTL
+#define MIN_FREQ      10      // 0.10Hz, output frequency in 1/100 Hz (DDS_HZ)
 
 #define OUTPUT_WAVEFORM_DEFAULT   SINUS
 #define OUTPUT_LEVEL_MODE_DEFAULT V_P2P   // Vpp
 #define OUTPUT_LEVEL_DEFAULT      200     // 2.0Vpp
-#define OUTPUT_FREQU_DEFAULT      1000    // 1kHz
+#define OUTPUT_FREQU_DEFAULT      (1000 * DDS_HZ) // 1kHz
 
 #define V_STEPSIZE_SMALL 1    // useful values are only 1,2 or 5
 
+#define SWEEP_LAW_DEFAULT   SWEEP_OFF
+#define SWEEP_STOP_DEFAULT  10000   // 10kHz
+#define SWEEP_STEPS_DEFAULT 20
+#define SWEEP_DWELL_DEFAULT 100     // 100ms
+
+#define MOD_TYPE_DEFAULT    MOD_OFF
+#define MOD_BAUD_DEFAULT    1200
+#define MOD_FREQU_DEFAULT   2200    // FSK frequency for bit 1
+#define MOD_PHASE_DEFAULT   180     // PSK phase for bit 1
+
+#define ENV_SHAPE_DEFAULT   ENV_OFF
+#define ENV_DEPTH_DEFAULT   50      // %
+#define ENV_RATE_DEFAULT    10      // Hz
+
+#define BURST_MODE_DEFAULT  BURST_OFF
+#define BURST_CYCLES_DEFAULT 10
+#define BURST_PERIOD_DEFAULT 100    // ms
+
+#define CAL_FREQU_MIN       100000  // Hz, MCLK calibration: 1.6M edges in 16s (0.6ppm)
+
 // fix definitions - don't change
 #define I_NORMAL      0       // immediate activation of new values without pushing the turn-push-button
 #define I_EXPLICIT    1       // activation of new values requires pushing the turn-push-button
 #define V_STEPSIZE_10 10
+#define RELAIS_SETTLE_TIME 10 // ms
+
+// staged output settings (transaction)
+#define TX_FREQUENCY  0x01
+#define TX_WAVEFORM   0x02
+#define TX_LEVEL      0x04
+#define TX_LEVELMODE  0x08
+#define TX_ENGINES    0x10    // sweep/modulation parameters changed
 
 // state machine states
 #define	M_IDLE        0
@@ -50,6 +80,16 @@
 #define M_LEVEL       2
 #define M_FREQUENCY1  3
 #define M_FREQUENCY2  4
+#define M_SWEEP1      5
+#define M_SWEEP2      6
+#define M_PRESET      7
+#define M_COUNTER     8
+
+// sweep parameter fields (M_SWEEP1/M_SWEEP2)
+#define SF_LAW        0
+#define SF_STEPS      1
+#define SF_DWELL      2
+#define SF_STOP       3
 
 //
 // global variables (set to default if required)
@@ -65,88 +105,1823 @@ uint8_t  tempWaveform = OUTPUT_WAVEFORM_DEFAULT;
 uint16_t tempLevel = OUTPUT_LEVEL_DEFAULT;
 uint32_t tempFrequency = OUTPUT_FREQU_DEFAULT;
 uint32_t tempDigit = OUTPUT_FREQU_DEFAULT;
-int8_t   ret = 0;
 int32_t  temp = 0;
-buttonEvent event;
-
-extern volatile uint8_t rotaryImpulseLeft;
-extern volatile uint8_t rotaryImpulseRight;
-
-volatile uint8_t systemIdleTime = 0;
-volatile uint8_t timer2 = 0;
 
 uint8_t outputLevelStepSize = V_STEPSIZE_SMALL;
 uint8_t inputMode = I_NORMAL;
+uint8_t outputEnabled = 1;            // output on/off (remote control only, always on after power on)
+
+// any combination of new output settings, activated together by commitOutputSettings()
+struct {
+  uint8_t  changed;                   // TX_FREQUENCY | TX_WAVEFORM | TX_LEVEL | ...
+  uint8_t  waveform;
+  uint8_t  levelMode;
+  uint16_t level;
+  uint32_t frequency;
+} staged = { 0, OUTPUT_WAVEFORM_DEFAULT, OUTPUT_LEVEL_MODE_DEFAULT, OUTPUT_LEVEL_DEFAULT, OUTPUT_FREQU_DEFAULT };
+
+uint8_t  presetSlot = 0;              // selected preset (M_PRESET)
+uint16_t presetLatency = 0;           // us from recall to new output setting
+#ifdef USE_COUNTER
+uint8_t  counterCalibrating = 0;      // M_COUNTER: gate of MCLK calibration running
+#endif
+
+#ifdef USE_SWEEP
+// sweep runs from output frequency to stop frequency
+uint8_t  sweepLaw = SWEEP_LAW_DEFAULT;
+uint32_t sweepStopFrequency = SWEEP_STOP_DEFAULT;
+uint8_t  sweepStepNumber = SWEEP_STEPS_DEFAULT;
+uint16_t sweepDwell = SWEEP_DWELL_DEFAULT;
+uint8_t  tempSweepLaw = SWEEP_LAW_DEFAULT;
+uint32_t tempSweepStop = SWEEP_STOP_DEFAULT;
+uint8_t  tempSweepSteps = SWEEP_STEPS_DEFAULT;
+uint16_t tempSweepDwell = SWEEP_DWELL_DEFAULT;
+uint8_t  sweepField = SF_LAW;
+// cursor position of sweep parameter fields
+const uint8_t sweepFieldCol[] = { 0, 6, 12, 10 };
+const uint8_t sweepFieldRow[] = { 1, 1, 1, 0 };
+#endif
+
+#ifdef USE_MODULATION
+// bit 0 is sent with output frequency, bit 1 with modFrequency (FSK) resp. modPhase (PSK)
+uint8_t  modType = MOD_TYPE_DEFAULT;
+uint16_t modBaud = MOD_BAUD_DEFAULT;
+uint32_t modFrequency = MOD_FREQU_DEFAULT;
+uint16_t modPhase = MOD_PHASE_DEFAULT;
+#endif
+
+#ifdef USE_ENVELOPE
+// output level follows envelope shape with depth (0...100%) & rate (periods per second)
+uint8_t  envShape = ENV_SHAPE_DEFAULT;
+uint8_t  envDepth = ENV_DEPTH_DEFAULT;
+uint16_t envRate = ENV_RATE_DEFAULT;
+#endif
+
+#ifdef USE_BURST
+// bursts of burstCycles periods, repeated every burstPeriod ms (BURST_INT) or triggered (BURST_EXT)
+uint8_t  burstMode = BURST_MODE_DEFAULT;
+uint16_t burstCycles = BURST_CYCLES_DEFAULT;
+uint16_t burstPeriod = BURST_PERIOD_DEFAULT;
+#endif
+
+#if DDS_CHANNELS > 1
+// phase offsets (deg) of the AD9833 channels, all channels output the same waveform & frequency
+uint16_t chanPhase[DDS_CHANNELS];
+#endif
+
+// for remembering settings after power off
+// (eWaveform, eLevel, eLevelMode & eFrequency only get read on first start after a firmware
+// update, since then these settings are kept in the record log eLog)
+uint8_t	 EEMEM eWaveform;
+uint16_t EEMEM eLevel;
+uint8_t  EEMEM eLevelMode;
+uint32_t EEMEM eFrequency;
+// record log & presets before all option dependent cells, so their addresses don't depend on
+// config.h and they survive a firmware update with other options
+uint8_t  EEMEM eLog[PER_RECORDS][PER_RECORD_SIZE];
+perPreset EEMEM ePreset[PER_PRESETS];
+perPresetExt EEMEM ePresetExt[PER_PRESETS];
+#ifdef USE_SWEEP
+uint8_t  EEMEM eSweepLaw;
+uint32_t EEMEM eSweepStop;
+uint8_t  EEMEM eSweepSteps;
+uint16_t EEMEM eSweepDwell;
+#endif
+#ifdef USE_MODULATION
+uint8_t  EEMEM eModType;
+uint16_t EEMEM eModBaud;
+uint32_t EEMEM eModFrequency;
+uint16_t EEMEM eModPhase;
+uint16_t EEMEM eModLength;
+uint8_t  EEMEM eModPattern[MOD_PATTERN_BYTES];
+#endif
+#ifdef USE_FLATNESS
+uint16_t EEMEM eFlatness[FLAT_POINTS];
+#endif
+#ifdef USE_ENVELOPE
+uint8_t  EEMEM eEnvShape;
+uint8_t  EEMEM eEnvDepth;
+uint16_t EEMEM eEnvRate;
+#endif
+#ifdef USE_BURST
+uint8_t  EEMEM eBurstMode;
+uint16_t EEMEM eBurstCycles;
+uint16_t EEMEM eBurstPeriod;
+#endif
+#ifdef USE_COUNTER
+uint32_t EEMEM eMclk;
+#endif
+#if DDS_CHANNELS > 1
+uint16_t EEMEM eChanPhase[DDS_CHANNELS];
+#endif
+
+// output settings changed but not yet stored (written after PERSIST_DELAY ms without changes)
+uint8_t settingsDirty = 0;
+
+#ifdef USE_WDT
+static void storeSettings();
+
+// watchdog timeout: pending settings get stored before the reset
+ISR (WDT_vect)
+{
+  if (settingsDirty) storeSettings();
+  PERFlush();
+  HALWatchdogReboot();            // reset right now
+}
+#endif
+
+// software timers (EXTTimerStart) & their events
+#define TIMER_IDLE    0
+#define TIMER_PERSIST 1
+#define EV_IDLE       (EV_TIMER + TIMER_IDLE)
+#define EV_PERSIST    (EV_TIMER + TIMER_PERSIST)
+
+// (re)starts resp. stops idle timeout, state falls back to M_IDLE after MAX_IDLE_TIME sec without input
+#define IdleTimerStart() EXTTimerStart(TIMER_IDLE, MAX_IDLE_TIME * 1000U)
+#define IdleTimerStop()  EXTTimerStop(TIMER_IDLE)
+
+//
+// some function definitions
+//
+static void SPIInit(void)
+{
+  HALSpiInit();                   // chip selects of DAC AD5452 & AD9833 (SPI SS pin) high
+}
+
+// output settings get stored deferred, not on every encoder impulse
+static void settingsChange()
+{
+  settingsDirty = 1;
+  EXTTimerStart(TIMER_PERSIST, PERSIST_DELAY);  // restarted by every change
+}
+
+// writes new record into EEPROM record log (non-blocking)
+static void storeSettings()
+{
+  perSettings settings;
+
+  settings.waveform = outputWaveform;
+  settings.levelMode = outputLevelMode;
+  settings.level = outputLevel;
+  settings.frequency = outputFrequency;
+  PERStore(&settings);
+  settingsDirty = 0;
+}
+
+#ifdef USE_ENVELOPE
+// (re)starts envelope with actual DAC level or stops it when off, square output has
+// no level & a running sweep/modulation has priority (shared timer 1)
+static void startEnvelope()
+{
+  if (!outputEnabled) return;
+  if (envShape == ENV_OFF || outputWaveform == SQUARE) ENVStop();
+#ifdef USE_SWEEP
+  else if (sweepLaw != SWEEP_OFF) ENVStop();
+#endif
+#ifdef USE_MODULATION
+  else if (modType != MOD_OFF) ENVStop();
+#endif
+#ifdef USE_BURST
+  else if (burstMode != BURST_OFF) ENVStop();
+#endif
+  else ENVStart(envShape, envDepth, envRate, EXTDacCode());
+}
+
+static void storeEnvelope()
+{
+  PERFlush();                     // record write must be complete
+  HALEepromWait();
+  HALEepromUpdateByte(&eEnvShape,envShape);
+  HALEepromWait();
+  HALEepromUpdateByte(&eEnvDepth,envDepth);
+  HALEepromWait();
+  HALEepromUpdateWord(&eEnvRate,envRate);
+}
+#endif
+
+#ifdef USE_BURST
+// (re)starts bursts with actual output frequency or sets output frequency again if off
+static void startBurst()
+{
+  if (!outputEnabled) return;
+  BSTStart(burstMode, burstCycles, burstPeriod, outputFrequency);
+  if (!BSTRunning()) DDSFreq(outputFrequency);
+}
+
+static void storeBurst()
+{
+  PERFlush();                     // record write must be complete
+  HALEepromWait();
+  HALEepromUpdateByte(&eBurstMode,burstMode);
+  HALEepromWait();
+  HALEepromUpdateWord(&eBurstCycles,burstCycles);
+  HALEepromWait();
+  HALEepromUpdateWord(&eBurstPeriod,burstPeriod);
+}
+#endif
+
+static void setAndStoreOutputLevel()
+{
+  if (outputEnabled) EXTDacSetLevel(outputLevel, outputWaveform, outputLevelMode);
+#ifdef USE_ENVELOPE
+  startEnvelope();                // envelope with new full level
+#endif
+  PROBE_OUTPUT();
+  settingsChange();
+}
+
+// switches between Vpp & Vrms, output level might slightly change due to rounding & casting
+static void setAndStoreOutputLevelMode(uint8_t levelMode)
+{
+  if (levelMode == outputLevelMode) return;
+  outputLevelMode = levelMode;
+  if (outputLevelMode == V_RMS) {
+    // converting output level from Vpp to Vrms
+    outputLevel = EXTLevelToVrms(outputLevel, outputWaveform);
+    if (outputLevelMaxVrms < outputLevel) outputLevel = outputLevelMaxVrms;
+    if (outputLevel < outputLevelMinVrms) outputLevel = outputLevelMinVrms;
+  }
+  else {
+    // converting output level from Vrms to Vpp
+    outputLevel = EXTLevelToVpp(outputLevel, outputWaveform);
+    if (OUTPUT_LEVEL_VPP_MAX < outputLevel) outputLevel = OUTPUT_LEVEL_VPP_MAX;
+    if (outputLevel < OUTPUT_LEVEL_VPP_MIN) outputLevel = OUTPUT_LEVEL_VPP_MIN;
+  }
+  tempLevel = outputLevel;
+  setAndStoreOutputLevel();
+}
+
+#if DDS_CHANNELS > 1
+// restarts all channels phase coherently with their phase offsets
+static void syncChannels()
+{
+  if (outputEnabled) DDSSync(chanPhase);
+}
+
+static void storeChannelPhase(uint8_t ch)
+{
+  PERFlush();                     // record write must be complete
+  HALEepromWait();
+  HALEepromUpdateWord(&eChanPhase[ch],chanPhase[ch]);
+}
+#endif
+
+#ifdef USE_SWEEP
+// (re)starts sweep from actual output frequency with actual sweep parameters
+// or sets output frequency again if sweep is off
+static void startSweep()
+{
+  uint32_t maxFrequency = (outputWaveform == SQUARE) ? MAX_FREQ_TTL : MAX_FREQ;
+
+  if (!outputEnabled) return;
+  SWPStart(outputFrequency, ((sweepStopFrequency < maxFrequency) ? sweepStopFrequency : maxFrequency) * DDS_HZ,
+           sweepStepNumber, sweepDwell, sweepLaw);
+  if (!SWPRunning()) DDSFreq(outputFrequency);
+}
+
+static void storeSweep()
+{
+  PERFlush();                     // record write must be complete
+  HALEepromWait();
+  HALEepromUpdateByte(&eSweepLaw,sweepLaw);
+  HALEepromWait();
+  HALEepromUpdateDword(&eSweepStop,sweepStopFrequency);
+  HALEepromWait();
+  HALEepromUpdateByte(&eSweepSteps,sweepStepNumber);
+  HALEepromWait();
+  HALEepromUpdateWord(&eSweepDwell,sweepDwell);
+}
+
+#ifdef USE_MODULATION
+static void setAndStoreModulation();
+#endif
+
+static void setAndStoreSweep()
+{
+#ifdef USE_MODULATION
+  if (sweepLaw != SWEEP_OFF && modType != MOD_OFF) {
+    // sweep & modulation share timer 1
+    modType = MOD_OFF;
+    setAndStoreModulation();
+  }
+#endif
+#ifdef USE_ENVELOPE
+  if (sweepLaw != SWEEP_OFF && envShape != ENV_OFF) {
+    // sweep & envelope share timer 1
+    envShape = ENV_OFF;
+    ENVStop();
+    storeEnvelope();
+  }
+#endif
+#ifdef USE_BURST
+  if (sweepLaw != SWEEP_OFF && burstMode != BURST_OFF) {
+    // sweep & burst share timer 1
+    burstMode = BURST_OFF;
+    BSTStop();
+    storeBurst();
+  }
+#endif
+  startSweep();
+  PROBE_OUTPUT();
+  storeSweep();
+}
+
+// steps up/down in a 1-2-5 sequence (1,2,5,10,20,50,...) within given limits
+static uint32_t step125(uint32_t val, int8_t dir, uint32_t minVal, uint32_t maxVal)
+{
+  uint32_t decade = 1;
+
+  while (val >= decade * 10) decade *= 10;
+  if (dir > 0) {
+    val = (val < 2 * decade) ? 2 * decade : ((val < 5 * decade) ? 5 * decade : 10 * decade);
+  }
+  else {
+    val = (val > 5 * decade) ? 5 * decade : ((val > 2 * decade) ? 2 * decade : ((val > decade) ? decade : decade / 2));
+  }
+  return((val < minVal) ? minVal : ((val > maxVal) ? maxVal : val));
+}
+#endif
+
+#ifdef USE_MODULATION
+// (re)starts modulation with bit pattern from EEPROM or sets output frequency again if off
+static void startModulation()
+{
+  if (!outputEnabled) return;
+  MODStart(modType, modBaud, outputFrequency, modFrequency * DDS_HZ, modPhase);
+  if (!MODRunning()) DDSFreq(outputFrequency);
+#if DDS_CHANNELS > 1
+  if (!MODRunning()) syncChannels();    // modulation has overwritten the phase offsets
+#endif
+}
+
+static void storeModulation()
+{
+  PERFlush();                     // record write must be complete
+  HALEepromWait();
+  HALEepromUpdateByte(&eModType,modType);
+  HALEepromWait();
+  HALEepromUpdateWord(&eModBaud,modBaud);
+  HALEepromWait();
+  HALEepromUpdateDword(&eModFrequency,modFrequency);
+  HALEepromWait();
+  HALEepromUpdateWord(&eModPhase,modPhase);
+}
+
+static void setAndStoreModulation()
+{
+#ifdef USE_SWEEP
+  if (modType != MOD_OFF && sweepLaw != SWEEP_OFF) {
+    // sweep & modulation share timer 1
+    sweepLaw = SWEEP_OFF;
+    PERFlush();                     // record write must be complete
+    HALEepromWait();
+    HALEepromUpdateByte(&eSweepLaw,sweepLaw);
+    EXTDisplaySweepState(SWEEP_OFF);
+  }
+#endif
+#ifdef USE_ENVELOPE
+  if (modType != MOD_OFF && envShape != ENV_OFF) {
+    // modulation & envelope share timer 1
+    envShape = ENV_OFF;
+    ENVStop();
+    storeEnvelope();
+  }
+#endif
+#ifdef USE_BURST
+  if (modType != MOD_OFF && burstMode != BURST_OFF) {
+    // modulation & burst share timer 1
+    burstMode = BURST_OFF;
+    BSTStop();
+    storeBurst();
+  }
+#endif
+  startModulation();
+  storeModulation();
+}
+
+static void storeModulationPattern()
+{
+  PERFlush();                     // record write must be complete
+  HALEepromWait();
+  HALEepromUpdateWord(&eModLength,modLength);
+  HALEepromWait();
+  HALEepromUpdateBlock(modPattern,eModPattern,MOD_PATTERN_BYTES);
+}
+#endif
+
+#ifdef USE_ENVELOPE
+static void setAndStoreEnvelope()
+{
+#ifdef USE_SWEEP
+  if (envShape != ENV_OFF && sweepLaw != SWEEP_OFF) {
+    // sweep & envelope share timer 1
+    sweepLaw = SWEEP_OFF;
+    SWPStop();
+    DDSFreq(outputFrequency);
+    PERFlush();                     // record write must be complete
+    HALEepromWait();
+    HALEepromUpdateByte(&eSweepLaw,sweepLaw);
+    EXTDisplaySweepState(SWEEP_OFF);
+  }
+#endif
+#ifdef USE_MODULATION
+  if (envShape != ENV_OFF && modType != MOD_OFF) {
+    // modulation & envelope share timer 1
+    modType = MOD_OFF;
+    MODStop();
+    storeModulation();
+  }
+#endif
+#ifdef USE_BURST
+  if (envShape != ENV_OFF && burstMode != BURST_OFF) {
+    // burst & envelope share timer 1
+    burstMode = BURST_OFF;
+    BSTStop();
+    DDSFreq(outputFrequency);
+    storeBurst();
+  }
+#endif
+  startEnvelope();
+  storeEnvelope();
+}
+#endif
+
+#ifdef USE_BURST
+static void setAndStoreBurst()
+{
+  if (burstMode != BURST_OFF) {
+    // sweep, modulation & envelope share timer 1 with burst
+#ifdef USE_SWEEP
+    if (sweepLaw != SWEEP_OFF) {
+      sweepLaw = SWEEP_OFF;
+      SWPStop();
+      PERFlush();                   // record write must be complete
+      HALEepromWait();
+      HALEepromUpdateByte(&eSweepLaw,sweepLaw);
+      EXTDisplaySweepState(SWEEP_OFF);
+    }
+#endif
+#ifdef USE_MODULATION
+    if (modType != MOD_OFF) {
+      modType = MOD_OFF;
+      MODStop();
+      storeModulation();
+    }
+#endif
+#ifdef USE_ENVELOPE
+    if (envShape != ENV_OFF) {
+      envShape = ENV_OFF;
+      ENVStop();
+      storeEnvelope();
+    }
+#endif
+  }
+  startBurst();
+  PROBE_OUTPUT();
+  storeBurst();
+}
+#endif
+
+#ifdef USE_FLATNESS
+static void storeFlatness()
+{
+  PERFlush();                     // record write must be complete
+  for (uint8_t n = 0; n < FLAT_POINTS; n++) {
+    HALEepromWait();
+    HALEepromUpdateWord(&eFlatness[n],EXTDacFlatnessGet(n));
+  }
+}
+
+// frequency (Hz) of calibration point, limited to MAX_FREQ
+static uint32_t flatnessFrequency(uint8_t point)
+{
+  uint32_t frequ = EXTDacFlatnessFrequency(point);
+
+  return((frequ < MAX_FREQ) ? frequ : MAX_FREQ);
+}
+#endif
+
+// shows output off resp. running sweep in front of frequency
+static void displayOutputState()
+{
+  EXTDisplayOutputState(outputEnabled);
+#ifdef USE_SWEEP
+  if (outputEnabled) EXTDisplaySweepState(SWPRunning() ? sweepLaw : SWEEP_OFF);
+#endif
+}
+
+// shows frequency actually synthesized (MCLK/2^28 steps) instead of the set one
+static void displayFrequency()
+{
+  EXTDisplayFrequency(DDSFreqActual(outputFrequency),0);
+}
+
+// redraws display with all output settings (e.g. after leaving sweep parameter setting)
+static void displayOutputSettings()
+{
+  displayOutputState();
+  displayFrequency();
+  EXTDisplayWaveform(outputWaveform);
+  if (outputWaveform != SQUARE) EXTDisplayLevel(outputLevel, outputLevelMode);
+}
+
+// (re)starts selected sweep or modulation with actual output frequency & waveform,
+// returns 0 if none is selected
+static uint8_t startEngines()
+{
+#ifdef USE_SWEEP
+  if (sweepLaw != SWEEP_OFF) {
+    startSweep();
+    return 1;
+  }
+#endif
+#ifdef USE_MODULATION
+  if (modType != MOD_OFF) {
+    startModulation();
+    return 1;
+  }
+#endif
+#ifdef USE_BURST
+  if (burstMode != BURST_OFF) {
+    startBurst();
+    return 1;
+  }
+#endif
+  return 0;
+}
+
+// sweep/modulation parameters changed: stops engines switched off, (re)starts selected one
+static void restartEngines()
+{
+#ifdef USE_MODULATION
+  if (modType == MOD_OFF) MODStop();
+#endif
+#ifdef USE_SWEEP
+  if (sweepLaw == SWEEP_OFF) SWPStop();
+#endif
+#ifdef USE_BURST
+  if (burstMode == BURST_OFF) BSTStop();
+#endif
+  if (!startEngines()) DDSFreq(outputFrequency);
+}
+
+// stops all engines (e.g. output off, timer 1 needed otherwise), selections are kept
+static void stopEngines()
+{
+#ifdef USE_SWEEP
+  SWPStop();
+#endif
+#ifdef USE_ENVELOPE
+  ENVStop();
+#endif
+#ifdef USE_MODULATION
+  MODStop();
+#endif
+#ifdef USE_BURST
+  BSTStop();
+#endif
+}
+
+static void setAndStoreOutputFrequency()
+{
+  // a selected sweep/modulation starts over from new output frequency
+  if (!startEngines()) DDSFreq(outputFrequency);
+#ifdef USE_ENVELOPE
+  startEnvelope();                // level might depend on frequency (USE_FLATNESS)
+#endif
+  PROBE_OUTPUT();
+  settingsChange();
+}            
+
+//
+// output setting transaction: stage any combination of frequency, waveform & level, then
+// commitOutputSettings() activates them in one sequence without intermediate output states
+//
+static void stageFrequency(uint32_t frequency)
+{
+  staged.frequency = frequency;
+  staged.changed |= TX_FREQUENCY;
+}
+
+static void stageWaveform(uint8_t waveform)
+{
+  staged.waveform = waveform;
+  staged.changed |= TX_WAVEFORM;
+}
+
+static void stageLevel(uint16_t level)
+{
+  staged.level = level;
+  staged.changed |= TX_LEVEL;
+}
+
+// level gets interpreted in new mode (no conversion)
+static void stageLevelMode(uint8_t levelMode)
+{
+  staged.levelMode = levelMode;
+  staged.changed |= TX_LEVELMODE;
+}
+
+// unit change (VOLT:UNIT): the staged resp. actual level gets converted, the output stays the same
+static void stageLevelUnit(uint8_t levelMode)
+{
+  uint8_t  waveform = (staged.changed & TX_WAVEFORM) ? staged.waveform : outputWaveform;
+  uint16_t level = (staged.changed & TX_LEVEL) ? staged.level : outputLevel;
+
+  if (levelMode == ((staged.changed & TX_LEVELMODE) ? staged.levelMode : outputLevelMode)) return;
+  stageLevel((levelMode == V_RMS) ? EXTLevelToVrms(level, waveform) : EXTLevelToVpp(level, waveform));
+  stageLevelMode(levelMode);
+}
+
+// sweep/modulation parameters have been changed directly
+static void stageEngines()
+{
+  staged.changed |= TX_ENGINES;
+}
+
+// sequence: limits of new waveform, mute, relais, DDS burst, DAC (unmute), persist, display
+static void commitOutputSettings()
+{
+  uint8_t  waveform = (staged.changed & TX_WAVEFORM) ? staged.waveform : outputWaveform;
+  uint32_t frequency = (staged.changed & TX_FREQUENCY) ? staged.frequency : outputFrequency;
+  uint16_t level = (staged.changed & TX_LEVEL) ? staged.level : outputLevel;
+  uint8_t  levelMode = (staged.changed & TX_LEVELMODE) ? staged.levelMode : outputLevelMode;
+  uint8_t  newEngines = staged.changed & TX_ENGINES;
+  uint8_t  newWaveform, newFrequency, newLevel;
+
+  staged.changed = 0;
+  // limits depend on (new) waveform
+  if (frequency > ((waveform == SQUARE) ? MAX_FREQ_TTL : MAX_FREQ) * DDS_HZ) {
+    // happens when waveform switched from TTL to SINUS/TRIANGLE
+    frequency = ((waveform == SQUARE) ? MAX_FREQ_TTL : MAX_FREQ) * DDS_HZ;
+  }
+  if (waveform != SQUARE) {
+    outputLevelMaxVrms = (waveform == SINUS) ? V_RMS_MAX_SIN : V_RMS_MAX_TRI;
+    outputLevelMinVrms = (waveform == SINUS) ? V_RMS_MIN_SIN : V_RMS_MIN_TRI;
+    if (levelMode != V_P2P && outputLevelMaxVrms < level) {
+      // max Vrms has been reduced (change from SINUS to TRIANGLE)
+      level = outputLevelMaxVrms;
+    }
+    else if (levelMode != V_P2P && level < outputLevelMinVrms) {
+      level = outputLevelMinVrms;
+    }
+    else if (OUTPUT_LEVEL_VPP_MAX < level) {
+      level = OUTPUT_LEVEL_VPP_MAX;
+    }
+  }
+  newWaveform = (waveform != outputWaveform);
+  newFrequency = (frequency != outputFrequency);
+  newLevel = (level != outputLevel || levelMode != outputLevelMode);
+  outputWaveform = waveform;
+  outputFrequency = frequency;
+  outputLevel = tempLevel = level;
+  outputLevelMode = levelMode;
+
+  // mute analog output while relais switches
+  if (newWaveform) {
+#ifdef USE_ENVELOPE
+    ENVStop();
+#endif
+    if (outputEnabled) EXTDacSetLevel(0, outputWaveform, V_P2P);
+    EXTRelaisOnOff((outputWaveform == SQUARE) ? RELAIS_ON : RELAIS_OFF);
+    HALDelay(RELAIS_SETTLE_TIME);
+  }
+  if (outputEnabled) {
+    // waveform & frequency in one SPI burst
+    if (newWaveform && newFrequency) DDSSetup(outputWaveform, outputFrequency);
+    else if (newWaveform) DDSSignal(outputWaveform);
+    else if (newFrequency) DDSFreq(outputFrequency);
+    // a selected sweep/modulation starts over with new frequency/waveform/parameters
+    if (newEngines) restartEngines();
+    else if (newWaveform || newFrequency) startEngines();
+    // unmute resp. new level
+    if (outputWaveform != SQUARE && (newWaveform || newLevel)) {
+      EXTDacSetLevel(outputLevel, outputWaveform, outputLevelMode);
+    }
+#ifdef USE_ENVELOPE
+    if (newWaveform || newFrequency || newLevel || newEngines) startEnvelope();
+#endif
+    PROBE_OUTPUT();
+  }
+
+  // persist all changes at once
+  if (newWaveform || newFrequency || newLevel) settingsChange();
+
+  if (newWaveform) EXTDisplayWaveform(outputWaveform);
+  if (newFrequency) displayFrequency();
+  if (outputWaveform != SQUARE && (newWaveform || newLevel)) EXTDisplayLevel(outputLevel, outputLevelMode);
+}
+
+//
+// presets: actual output settings incl. sweep/modulation parameters in PER_PRESETS slots
+//
+static void savePreset(uint8_t slot)
+{
+  perPreset preset;
+
+  memset(&preset, 0, sizeof(preset));
+  preset.frequency = outputFrequency / DDS_HZ;
+  preset.waveform = outputWaveform;
+  preset.levelMode = outputLevelMode;
+  preset.level = outputLevel;
+#ifdef USE_SWEEP
+  preset.sweepLaw = sweepLaw;
+  preset.sweepStop = sweepStopFrequency;
+  preset.sweepSteps = sweepStepNumber;
+  preset.sweepDwell = sweepDwell;
+#endif
+#ifdef USE_MODULATION
+  preset.modType = modType;
+  preset.modFrequency = modFrequency;
+  preset.modPhase = modPhase;
+  preset.modBaud = modBaud;
+#endif
+  PERPresetSave(slot, &preset, outputFrequency % DDS_HZ);
+}
+
+// shows preset settings (M_PRESET)
+static void displayPreset(uint8_t slot)
+{
+  perPreset preset;
+  uint8_t   centiHz;
+  uint8_t   used = PERPresetLoad(slot, &preset, &centiHz);
+
+  EXTDisplayPreset(slot, used);
+  if (used) {
+    EXTDisplayFrequency((uint32_t)preset.frequency * DDS_HZ + centiHz,0);
+    EXTDisplayWaveform(preset.waveform);
+    if (preset.waveform != SQUARE) EXTDisplayLevel(preset.level, preset.levelMode);
+  }
+}
+
+// activates preset with one transaction, returns 0 if slot is empty
+static uint8_t recallPreset(uint8_t slot)
+{
+  perPreset     preset;
+  uint8_t       centiHz;
+  unsigned long start = HALMicros();
+
+  if (!PERPresetLoad(slot, &preset, &centiHz)) return 0;
+  stageWaveform(preset.waveform);
+  stageFrequency((uint32_t)preset.frequency * DDS_HZ + centiHz);
+  stageLevelMode(preset.levelMode);
+  stageLevel(preset.level);
+#ifdef USE_SWEEP
+  sweepLaw = preset.sweepLaw;
+  sweepStopFrequency = tempSweepStop = preset.sweepStop;
+  sweepStepNumber = tempSweepSteps = preset.sweepSteps;
+  sweepDwell = tempSweepDwell = preset.sweepDwell;
+  tempSweepLaw = sweepLaw;
+  stageEngines();
+#endif
+#ifdef USE_MODULATION
+  modType = preset.modType;
+  modFrequency = preset.modFrequency;
+  modPhase = preset.modPhase;
+  modBaud = preset.modBaud;
+  stageEngines();
+#endif
+  commitOutputSettings();
+  presetLatency = (uint16_t)(HALMicros() - start);
+
+#ifdef USE_SWEEP
+  storeSweep();
+#endif
+#ifdef USE_MODULATION
+  storeModulation();
+#endif
+  displayOutputSettings();
+  return 1;
+}
+
+// output on/off: DDS stopped & DAC at zero when off, all settings are kept
+static void setOutputEnabled(uint8_t enable)
+{
+  if (enable == outputEnabled) return;
+  outputEnabled = enable;
+  if (outputEnabled) {
+    DDSSetup(outputWaveform, outputFrequency);
+    EXTDacSetLevel(outputLevel, outputWaveform, outputLevelMode);
+    startEngines();
+#ifdef USE_ENVELOPE
+    startEnvelope();
+#endif
+  }
+  else {
+    stopEngines();
+    DDSOff();
+    EXTDacSetLevel(0, outputWaveform, V_P2P);
+  }
+}
+
+#ifdef USE_COUNTER
+//
+// frequency counter (M_COUNTER): timer 1 counts the edges at T1 (PD5), so all engines are
+// stopped meanwhile. The output keeps running, fed back to T1 as SQUARE it calibrates MCLK.
+//
+static void storeClock()
+{
+  PERFlush();                     // record write must be complete
+  HALEepromWait();
+  HALEepromUpdateDword(&eMclk,DDSClockGet());
+}
+
+static void enterCounter()
+{
+  systemState = M_COUNTER;
+  counterCalibrating = 0;
+  stopEngines();
+  if (outputEnabled) DDSFreq(outputFrequency);
+  EXTCounterStart(COUNTER_GATE);
+  EXTDisplayCounter(0, 0, DDSClockGet());
+}
+
+static void leaveCounter()
+{
+  EXTCounterStop();
+  counterCalibrating = 0;
+  systemState = M_IDLE;
+  if (outputEnabled) {
+    startEngines();
+#ifdef USE_ENVELOPE
+    startEnvelope();
+#endif
+  }
+  EXTDisplayClear();
+  displayOutputSettings();
+}
+#endif
+
+#ifdef USE_SERIAL
+//
+// non-blocking SCPI style remote control, several commands per line separated by ';' (case insensitive):
+//   *IDN?  *OPC?  *SAV <1..8>  *RCL <1..8>  FREQ <Hz>|?  FUNC SIN|TRI|SQU|?  VOLT <V>|?
+//   VOLT:UNIT VPP|VRMS|?  OUTP ON|OFF|?  SYST:LAT?  SYST:RCL?  SYST:LCD?  (MOD:TYPE OFF|FSK|PSK|OOK|?
+//   MOD:BAUD <n>|?  MOD:FREQ <Hz>|?  MOD:PHAS <deg>|?  MOD:DATA <0101...> with USE_MODULATION)
+//   (SYST:PROB?|CLR with USE_PROBES)  (AM:SHAP OFF|SIN|RAMP|ADSR|?  AM:DEPT <%>|?  AM:FREQ <Hz>|?
+//   with USE_ENVELOPE)  (BURS:MODE OFF|INT|EXT|?  BURS:NCYC <n>|?  BURS:PER <ms>|?  *TRG with USE_BURST)
+//   (CAL:FLAT <0..8>|RST|?  CAL:MEAS <V> with USE_FLATNESS)  (CAL:MCLK <Hz>|RST|? with USE_COUNTER)
+//   (CHAN<n>:PHAS <deg>|?  CHAN:SYNC with DDS_CHANNELS > 1)
+// FREQ takes and returns up to 2 decimals (e.g. "FREQ 1000.25"), FREQ? the set frequency.
+// Characters are taken one by one from the serial RX ring buffer, loop() is never blocked.
+// A line gets checked completely before any command of it is executed, so a line with an
+// invalid command (ERR) has no effect at all. Checks of the actual state (CAL:MEAS, *TRG, *RCL
+// of an empty slot) see the state before the line.
+// Set commands use the same paths as the front panel, SYST:LAT? returns the time in us from
+// complete command line to new output setting, SYST:RCL? from preset recall to new output
+// setting, SYST:LCD? the LCD bytes saved so far by only sending changed display cells.
+// SYST:PROB? returns one line per latency probe: name min avg max count & 8 histogram buckets
+// (<128us, <256us ... <8ms, >=8ms), all times in us.
+//
+static char     serialLine[40];
+static uint8_t  serialLength = 0;
+static uint8_t  serialBits = 0;       // receiving MOD:DATA bits
+static uint16_t serialLatency = 0;
+static uint32_t displaySaved = 0;     // LCD bytes saved by shadow buffer
+
+// parses unsigned decimal number, returns 0 if not valid
+static uint8_t remoteNumber(const char *arg, uint32_t *num)
+{
+  if (*arg < '0' || *arg > '9') return 0;
+  for (*num = 0; *arg >= '0' && *arg <= '9'; arg++) *num = *num * 10 + (*arg - '0');
+  return (*arg == 0);
+}
+
+// parses number with max. 2 decimals (e.g. voltage "2.5", frequency "1000.25") into 1/100,
+// returns 0 if not valid or >= 10^7
+static uint8_t remoteFixed(const char *arg, uint32_t *value)
+{
+  uint8_t decimals = 0;
+
+  if ((*arg < '0' || *arg > '9') && *arg != '.') return 0;
+  for (*value = 0; *arg; arg++) {
+    if (*arg == '.' && !decimals) decimals = 1;
+    else if (*arg >= '0' && *arg <= '9') {
+      // digits after the 2nd decimal get ignored
+      if (decimals < 3) {
+        if (*value > 99999999UL) return 0;
+        *value = *value * 10 + (*arg - '0');
+      }
+      if (decimals && decimals < 3) decimals++;
+    }
+    else return 0;
+  }
+  for (decimals = (decimals ? decimals : 1); decimals < 3; decimals++) {
+    if (*value > 99999999UL) return 0;
+    *value *= 10;
+  }
+  return 1;
+}
+
+static void remotePrintFixed(uint32_t value)
+{
+  Serial.print(value / 100);
+  Serial.print('.');
+  if (value % 100 < 10) Serial.print('0');
+  Serial.println(value % 100);
+}
+
+// checks (run 0) resp. executes (run 1) one command, returns 0 if command or parameter invalid:
+// the check has no effect apart from staging, FREQ/FUNC/VOLT/VOLT:UNIT get staged in both
+// passes and are committed together at end of line, all other commands act when executed
+static uint8_t remoteExecute(const char *header, char *arg, uint8_t query, uint8_t run)
+{
+  uint32_t num = 0;
+  uint8_t  waveform = (staged.changed & TX_WAVEFORM) ? staged.waveform : outputWaveform;
+  uint8_t  levelMode = (staged.changed & TX_LEVELMODE) ? staged.levelMode : outputLevelMode;
+
+  if (!strcmp(header, "*IDN")) {
+    if (!query) return 0;
+    if (run) Serial.println(F("yellobyte,DDS Function Generator AD9833"));
+  }
+  else if (!strcmp(header, "*OPC")) {
+    if (!query) return 0;
+    if (run) Serial.println(1);
+  }
+  else if (!strcmp(header, "SYST:LAT")) {
+    if (!query) return 0;
+    if (run) Serial.println(serialLatency);
+  }
+  else if (!strcmp(header, "*SAV")) {
+    if (query || !remoteNumber(arg, &num) || num < 1 || num > PER_PRESETS) return 0;
+    if (run) savePreset(num - 1);
+  }
+  else if (!strcmp(header, "*RCL")) {
+    if (query || !remoteNumber(arg, &num) || num < 1 || num > PER_PRESETS) return 0;
+    if (!run) {
+      perPreset preset;
+      uint8_t   centiHz;
+      if (!PERPresetLoad(num - 1, &preset, &centiHz)) return 0;
+    }
+    else if (!recallPreset(num - 1)) return 0;
+  }
+  else if (!strcmp(header, "SYST:RCL")) {
+    if (!query) return 0;
+    if (run) Serial.println(presetLatency);
+  }
+  else if (!strcmp(header, "SYST:LCD")) {
+    if (!query) return 0;
+    if (run) Serial.println(displaySaved);
+  }
+#ifdef USE_PROBES
+  else if (!strcmp(header, "SYST:PROB")) {
+    if (query) {
+      if (run) PRBReport();
+    }
+    else if (!strcmp(arg, "CLR")) {
+      if (run) PRBClear();
+    }
+    else return 0;
+  }
+#endif
+#ifdef USE_ENVELOPE
+  else if (!strcmp(header, "AM:SHAP")) {
+    if (query) {
+      if (run) Serial.println((envShape == ENV_SIN) ? F("SIN") : ((envShape == ENV_RAMP) ? F("RAMP") : ((envShape == ENV_ADSR) ? F("ADSR") : F("OFF"))));
+    }
+    else {
+      if (!strcmp(arg, "SIN")) num = ENV_SIN;
+      else if (!strcmp(arg, "RAMP")) num = ENV_RAMP;
+      else if (!strcmp(arg, "ADSR")) num = ENV_ADSR;
+      else if (!strcmp(arg, "OFF")) num = ENV_OFF;
+      else return 0;
+      if (run) {
+        envShape = num;
+        setAndStoreEnvelope();
+      }
+    }
+  }
+  else if (!strcmp(header, "AM:DEPT")) {
+    if (query) {
+      if (run) Serial.println(envDepth);
+    }
+    else if (!remoteNumber(arg, &num) || num > ENV_DEPTH_MAX) return 0;
+    else if (run) {
+      envDepth = num;
+      setAndStoreEnvelope();
+    }
+  }
+  else if (!strcmp(header, "AM:FREQ")) {
+    if (query) {
+      if (run) Serial.println(envRate);
+    }
+    else if (!remoteNumber(arg, &num) || num < ENV_RATE_MIN || num > ENV_RATE_MAX) return 0;
+    else if (run) {
+      envRate = num;
+      setAndStoreEnvelope();
+    }
+  }
+#endif
+#ifdef USE_BURST
+  else if (!strcmp(header, "BURS:MODE")) {
+    if (query) {
+      if (run) Serial.println((burstMode == BURST_INT) ? F("INT") : ((burstMode == BURST_EXT) ? F("EXT") : F("OFF")));
+    }
+    else {
+      if (!strcmp(arg, "INT")) num = BURST_INT;
+      else if (!strcmp(arg, "EXT")) num = BURST_EXT;
+      else if (!strcmp(arg, "OFF")) num = BURST_OFF;
+      else return 0;
+      if (run) {
+        burstMode = num;
+        setAndStoreBurst();
+      }
+    }
+  }
+  else if (!strcmp(header, "BURS:NCYC")) {
+    if (query) {
+      if (run) Serial.println(burstCycles);
+    }
+    else if (!remoteNumber(arg, &num) || num < BURST_CYCLES_MIN || num > BURST_CYCLES_MAX) return 0;
+    else if (run) {
+      burstCycles = num;
+      setAndStoreBurst();
+    }
+  }
+  else if (!strcmp(header, "BURS:PER")) {
+    if (query) {
+      if (run) Serial.println(burstPeriod);
+    }
+    else if (!remoteNumber(arg, &num) || num < BURST_PERIOD_MIN || num > BURST_PERIOD_MAX) return 0;
+    else if (run) {
+      burstPeriod = num;
+      setAndStoreBurst();
+    }
+  }
+  else if (!strcmp(header, "*TRG")) {
+    // software trigger, only if waiting for one (BURST_EXT)
+    if (query || burstMode != BURST_EXT) return 0;
+    if (run) BSTTrigger();
+  }
+#endif
+#ifdef USE_COUNTER
+  else if (!strcmp(header, "CAL:MCLK")) {
+    // e.g. measured with a precise counter at 5MHz: MCLK = 25MHz * measured / 5MHz
+    if (query) {
+      if (run) Serial.println(DDSClockGet());
+    }
+    else {
+      if (!strcmp(arg, "RST")) num = AD9833_MCLK;
+      else if (!remoteNumber(arg, &num) || num < AD9833_MCLK - AD9833_MCLK_TOL || num > AD9833_MCLK + AD9833_MCLK_TOL) return 0;
+      if (!run) return 1;
+      DDSClockSet(num);
+      storeClock();
+      stageEngines();             // new register values for actual frequency
+    }
+  }
+#endif
+#ifdef USE_FLATNESS
+  else if (!strcmp(header, "CAL:FLAT")) {
+    if (query) {
+      // one line per calibration point: point frequency factor (4096 = 1.0)
+      if (!run) return 1;
+      for (uint8_t n = 0; n < FLAT_POINTS; n++) {
+        Serial.print(n);
+        Serial.print(' ');
+        Serial.print(flatnessFrequency(n));
+        Serial.print(' ');
+        Serial.println(EXTDacFlatnessGet(n));
+      }
+    }
+    else if (!strcmp(arg, "RST")) {
+      if (!run) return 1;
+      for (uint8_t n = 0; n < FLAT_POINTS; n++) EXTDacFlatnessSet(n, FLAT_ONE);
+      storeFlatness();
+    }
+    else if (!remoteNumber(arg, &num) || num >= FLAT_POINTS) return 0;
+    else stageFrequency(flatnessFrequency(num) * DDS_HZ);
+  }
+  else if (!strcmp(header, "CAL:MEAS")) {
+    // level measured at actual output frequency, same unit as set level
+    if (query || outputWaveform == SQUARE || !remoteFixed(arg, &num) || !num || num > 0xFFFF) return 0;
+    if (!run) return 1;
+    EXTDacFlatnessCalibrate(outputLevel, num);
+    storeFlatness();
+  }
+#endif
+  else if (!strcmp(header, "FREQ")) {
+    if (query) {
+      if (run) remotePrintFixed(outputFrequency);
+    }
+    else if (!remoteFixed(arg, &num) || num < MIN_FREQ || num > ((waveform == SQUARE) ? MAX_FREQ_TTL : MAX_FREQ) * DDS_HZ) return 0;
+    else stageFrequency(num);
+  }
+  else if (!strcmp(header, "FUNC")) {
+    if (query) {
+      if (run) Serial.println((outputWaveform == SINUS) ? F("SIN") : ((outputWaveform == SQUARE) ? F("SQU") : F("TRI")));
+    }
+    else if (!strcmp(arg, "SIN")) stageWaveform(SINUS);
+    else if (!strcmp(arg, "TRI")) stageWaveform(TRIANGLE);
+    else if (!strcmp(arg, "SQU")) stageWaveform(SQUARE);
+    else return 0;
+  }
+  else if (!strcmp(header, "VOLT")) {
+    if (query) {
+      if (run) remotePrintFixed(outputLevel);
+    }
+    else if (waveform == SQUARE || !remoteFixed(arg, &num) ||
+             num < ((levelMode == V_P2P) ? OUTPUT_LEVEL_VPP_MIN : ((waveform == SINUS) ? V_RMS_MIN_SIN : V_RMS_MIN_TRI)) ||
+             num > ((levelMode == V_P2P) ? OUTPUT_LEVEL_VPP_MAX : ((waveform == SINUS) ? V_RMS_MAX_SIN : V_RMS_MAX_TRI))) return 0;
+    else stageLevel(num);
+  }
+  else if (!strcmp(header, "VOLT:UNIT")) {
+    if (query) {
+      if (run) Serial.println((outputLevelMode == V_P2P) ? F("VPP") : F("VRMS"));
+    }
+    else if (!strcmp(arg, "VPP")) stageLevelUnit(V_P2P);
+    else if (!strcmp(arg, "VRMS")) stageLevelUnit(V_RMS);
+    else return 0;
+  }
+  else if (!strcmp(header, "OUTP")) {
+    if (query) {
+      if (run) Serial.println(outputEnabled);
+    }
+    else if (!strcmp(arg, "ON") || !strcmp(arg, "1")) {
+      if (run) setOutputEnabled(1);
+    }
+    else if (!strcmp(arg, "OFF") || !strcmp(arg, "0")) {
+      if (run) setOutputEnabled(0);
+    }
+    else return 0;
+  }
+#ifdef USE_MODULATION
+  else if (!strcmp(header, "MOD:TYPE")) {
+    if (query) {
+      if (run) Serial.println((modType == MOD_FSK) ? F("FSK") : ((modType == MOD_PSK) ? F("PSK") : ((modType == MOD_OOK) ? F("OOK") : F("OFF"))));
+    }
+    else {
+      if (!strcmp(arg, "FSK")) num = MOD_FSK;
+      else if (!strcmp(arg, "PSK")) num = MOD_PSK;
+      else if (!strcmp(arg, "OOK")) num = MOD_OOK;
+      else if (!strcmp(arg, "OFF")) num = MOD_OFF;
+      else return 0;
+      if (run) {
+        modType = num;
+        setAndStoreModulation();
+      }
+    }
+  }
+  else if (!strcmp(header, "MOD:BAUD")) {
+    if (query) {
+      if (run) Serial.println(modBaud);
+    }
+    else if (!remoteNumber(arg, &num) || num < MOD_BAUD_MIN || num > MOD_BAUD_MAX) return 0;
+    else if (run) {
+      modBaud = num;
+      setAndStoreModulation();
+    }
+  }
+  else if (!strcmp(header, "MOD:FREQ")) {
+    if (query) {
+      if (run) Serial.println(modFrequency);
+    }
+    else if (!remoteNumber(arg, &num) || num < 1 || num > MAX_FREQ_TTL) return 0;
+    else if (run) {
+      modFrequency = num;
+      setAndStoreModulation();
+    }
+  }
+  else if (!strcmp(header, "MOD:PHAS")) {
+    if (query) {
+      if (run) Serial.println(modPhase);
+    }
+    else if (!remoteNumber(arg, &num) || num >= 360) return 0;
+    else if (run) {
+      modPhase = num;
+      setAndStoreModulation();
+    }
+  }
+  else if (!strcmp(header, "MOD:DATA")) {
+    // bits have already been stored while receiving
+    if (query || !modLength) return 0;
+    if (!run) return 1;
+    storeModulationPattern();
+    startModulation();
+  }
+#endif
+#if DDS_CHANNELS > 1
+  else if (!strncmp(header, "CHAN", 4) && header[4] >= '1' && header[4] < '1' + DDS_CHANNELS &&
+           !strcmp(&header[5], ":PHAS")) {
+    uint8_t ch = header[4] - '1';
+    if (query) {
+      if (run) Serial.println(chanPhase[ch]);
+    }
+    else if (!remoteNumber(arg, &num) || num >= 360) return 0;
+    else if (run) {
+      chanPhase[ch] = num;
+      storeChannelPhase(ch);
+      syncChannels();
+      stageEngines();             // sweep/burst start over from the synchronised phases
+    }
+  }
+  else if (!strcmp(header, "CHAN:SYNC")) {
+    if (query) return 0;
+    if (!run) return 1;
+    syncChannels();
+    stageEngines();
+  }
+#endif
+  else return 0;
+  return 1;
+}
+
+// executes a complete command line, several commands can be separated by ';'
+// (e.g. "FUNC SIN;FREQ 1000;VOLT 2.5" gets activated in one transaction): the whole line gets
+// checked first, an invalid command discards it without any effect (ERR)
+static void remoteCommand()
+{
+  char    line[sizeof(serialLine)];
+  char    *cmd, *next, *arg, *end;
+  uint8_t query, set = 0;
+  unsigned long start = HALMicros();
+
+  for (uint8_t run = 0; run < 2; run++) {
+    // every pass splits its own copy of the line
+    memcpy(line, serialLine, sizeof(line));
+    staged.changed = 0;
+    for (cmd = line; cmd; cmd = next) {
+      next = strchr(cmd, ';');
+      if (next) *next++ = 0;
+      while (*cmd == ' ') cmd++;
+      // split into header & argument, header ending with '?' is a query
+      arg = strchr(cmd, ' ');
+      if (arg) {
+        end = arg;
+        *arg++ = 0;
+      }
+      else {
+        end = arg = cmd + strlen(cmd);
+      }
+      query = (end > cmd && *(end - 1) == '?');
+      if (query) *(end - 1) = 0;
+      if (!cmd[0]) continue;
+      if (!remoteExecute(cmd, arg, query, run)) {
+        // staged settings of this line get dropped, the display shows what has been executed
+        // (only possible if a command changed the state a later one got checked against)
+        staged.changed = 0;
+        Serial.println(F("ERR"));
+        if (run && set) displayOutputSettings();
+        return;
+      }
+      if (!query) set = run;
+    }
+  }
+
+  if (set) {
+#ifdef USE_COUNTER
+    if (systemState == M_COUNTER) leaveCounter();
+#endif
+    commitOutputSettings();
+    serialLatency = (uint16_t)(HALMicros() - start);
+    // local setting gets cancelled, display shows new settings
+    if (systemState != M_IDLE) {
+      systemState = M_IDLE;
+      IdleTimerStop();
+      HALLcdCursor(0);
+      HALLcdBlink(0);
+    }
+    displayOutputSettings();
+  }
+}
+
+static void remotePoll()
+{
+  while (Serial.available()) {
+    char c = toupper(Serial.read());
+    if (c == '\r') continue;
+    if (c == '\n') {
+      serialBits = 0;
+      PROBE_MARK();
+      remoteCommand();
+      PROBE_UNMARK();
+      serialLength = 0;
+      serialLine[0] = 0;
+    }
+#ifdef USE_MODULATION
+    else if (serialBits) {
+      // bits are stored directly into the bit pattern
+      if ((c == '0' || c == '1') && modLength < MOD_BITS_MAX) {
+        if (c == '1') modPattern[modLength >> 3] |= (0x80 >> (modLength & 7));
+        else modPattern[modLength >> 3] &= ~(0x80 >> (modLength & 7));
+        modLength++;
+      }
+    }
+#endif
+    else if (serialLength < sizeof(serialLine) - 1) {
+      serialLine[serialLength++] = c;
+      serialLine[serialLength] = 0;
+#ifdef USE_MODULATION
+      if (!strcmp(serialLine, "MOD:DATA ")) {
+        // pattern must not change while modulation is running
+        MODStop();
+        modLength = 0;
+        serialBits = 1;
+        serialLength--;
+        serialLine[serialLength] = 0;
+      }
+#endif
+    }
+  }
+}
+#endif
+
+//
+// event driven user interface: every state has a handler which gets the events of encoder,
+// buttons & software timers (see EXTEventGet). loop() sleeps until an interrupt occurs (1ms
+// tick, encoder, serial RX), so an input event gets handled within 1ms plus the time of the
+// handler in front of it. Longest handlers are a waveform change (~10ms relais settle time),
+// storing sweep parameters (~37ms EEPROM) and saving a preset (~60ms EEPROM), a full LCD
+// redraw takes ~40ms whereas a typical flush of changed cells only takes a few ms.
+//
+typedef void (*stateHandler)(uint8_t event);
+
+// activates selected waveform (M_WAVEFORM)
+static void applyWaveform()
+{
+  if (tempWaveform != outputWaveform) {
+    stageWaveform(tempWaveform);
+    commitOutputSettings();
+    if (inputMode == I_EXPLICIT) EXTBuzzerPlay(BUZZER_SINGLE);
+  }
+  EXTDisplayCursor(0,1);
+}
+
+// sets cursor onto selected frequency digit ("ddddddd.ddHz", 0.01Hz digit at col 13)
+static void frequencyCursor()
+{
+  uint8_t col = 13;
+
+  for (uint32_t d = 1; d < tempDigit && col > 4; d *= 10) col -= (col == 12) ? 2 : 1;
+  EXTDisplayCursor(col,0);
+}
 
-// for remembering settings after power off
-uint8_t	 EEMEM eWaveform;
-uint16_t EEMEM eLevel;
-uint8_t  EEMEM eLevelMode;
-uint32_t EEMEM eFrequency;
+// starts selecting frequency digits (M_FREQUENCY1), shows set instead of synthesized frequency
+static void enterFrequency()
+{
+  systemState = M_FREQUENCY1;
+  tempFrequency = outputFrequency;
+  tempDigit = (tempFrequency >= 1000000UL * DDS_HZ) ? 100000UL * DDS_HZ : 1000UL * DDS_HZ;
+  EXTDisplayFrequency(tempFrequency,0);
+  frequencyCursor();
+  HALLcdCursor(1);
+  HALLcdBlink(0);
+}
 
-LiquidCrystal_I2C lcd(0x27,16,2); // set the LCD I2C address, 16 cols, 2 rows
+// starts selecting waveform (M_WAVEFORM)
+static void enterWaveform()
+{
+  systemState = M_WAVEFORM;
+  tempWaveform = outputWaveform;
+  EXTDisplayCursor(0,1);
+  HALLcdBlink(1);
+}
 
-#ifdef USE_WDT
-//ISR (WDT_vect) {}               // could be used instead of a default WDT reset (power reset)
+// select switch pressed in M_FREQUENCY1/M_FREQUENCY2
+static void leaveFrequency()
+{
+  if (outputFrequency < MIN_FREQ) {
+    outputFrequency = OUTPUT_FREQU_DEFAULT;
+    setAndStoreOutputFrequency();
+    EXTBuzzerPlay(BUZZER_ERROR);
+  }
+#ifdef USE_SWEEP
+  systemState = M_SWEEP1;
+  sweepField = SF_LAW;
+  tempSweepLaw = sweepLaw;
+  tempSweepStop = sweepStopFrequency;
+  tempSweepSteps = sweepStepNumber;
+  tempSweepDwell = sweepDwell;
+  EXTDisplaySweep(tempSweepLaw, tempSweepSteps, tempSweepDwell, tempSweepStop);
+  EXTDisplayCursor(sweepFieldCol[sweepField],sweepFieldRow[sweepField]);
+  HALLcdCursor(1);
+  HALLcdBlink(0);
+#else
+  displayFrequency();
+  enterWaveform();
 #endif
+}
 
-//
-// macros & ISR function for hardware timer 2 of Atmega328
-// (8-bit Timer 2 with base clock 15625Hz (F_CPU/1024): overflow every 1/61s=~16ms)
-//
-#define Timer2Init() {\
-  TCCR2B |= (1<<CS22) | (1<<CS21) |(1<<CS20);\
+static void idleHandler(uint8_t event)
+{
+  // we are idle and only react on select switch & encoder button (presets)
+  if (event == EV_SHORT) {
+    systemState = M_PRESET;
+    displayPreset(presetSlot);
+  }
+  else if (event == EV_SELECT) {
+    enterWaveform();
+  }
+#ifdef USE_COUNTER
+  else if (event == EV_LONG) {
+    enterCounter();
+  }
+#endif
 }
 
-// enable timer 2 overflow interrupt (start timer 2)
-#define Timer2Start() {\
-  timer2 = 0;\
-  systemIdleTime = 0;\
-  TIMSK2 |= (1<<TOIE2);\
+static void waveformHandler(uint8_t event)
+{
+  // selecting waveform
+  switch (event) {
+    case EV_IDLE:
+      systemState = M_IDLE;
+      HALLcdCursor(0);
+      if (tempWaveform != outputWaveform) EXTDisplayWaveform(outputWaveform);
+      if (outputWaveform != SQUARE) EXTDisplayLevel(outputLevel, outputLevelMode);
+      break;
+    case EV_LEFT:
+      switch (tempWaveform) {
+        case SINUS: tempWaveform = SQUARE; break;
+        case SQUARE: tempWaveform = TRIANGLE; break;
+        default: tempWaveform = SINUS; break;
+      }
+      if (inputMode == I_NORMAL) applyWaveform();
+      else {
+        EXTDisplayWaveform(tempWaveform);
+        if (tempWaveform != SQUARE) EXTDisplayLevel(outputLevel, outputLevelMode);
+        EXTDisplayCursor(0,1);
+      }
+      break;
+    case EV_RIGHT:
+      switch (tempWaveform) {
+        case SINUS: tempWaveform = TRIANGLE; break;
+        case TRIANGLE: tempWaveform = SQUARE; break;
+        default: tempWaveform = SINUS; break;
+      }
+      if (inputMode == I_NORMAL) applyWaveform();
+      else {
+        EXTDisplayWaveform(tempWaveform);
+        if (tempWaveform != SQUARE) EXTDisplayLevel(outputLevel, outputLevelMode);
+        EXTDisplayCursor(0,1);
+      }
+      break;
+    case EV_SHORT:
+    case EV_LONG:
+      applyWaveform();
+      break;
+    case EV_SELECT:
+      if (tempWaveform != outputWaveform) EXTDisplayWaveform(outputWaveform);
+      if (outputWaveform != SQUARE) {
+        // output level can only be changed for sinus and triangle waveform
+        systemState = M_LEVEL;
+        tempLevel = outputLevel;
+        EXTDisplayLevel(outputLevel, outputLevelMode);
+        EXTDisplayCursor((outputLevelStepSize == V_STEPSIZE_10 ? 11 : 12),1);
+        HALLcdBlink(1);
+      }
+      else {
+        // square was selected -> TTL level can't be changed
+        enterFrequency();
+      }
+      break;
+    default: break;
+  }
 }
 
-// disable timer 2 interrupt (stop timer 2)
-#define Timer2Stop() {\
-  TIMSK2 &= (~(1<<TOIE2));\
+static void levelHandler(uint8_t event)
+{
+  // changing output level (sinus & triangle)
+  switch (event) {
+    case EV_IDLE:
+      systemState = M_IDLE;
+      HALLcdCursor(0);
+      HALLcdBlink(0);
+      if (tempLevel != outputLevel) EXTDisplayLevel(outputLevel, outputLevelMode);
+      break;
+    case EV_LEFT:
+    case EV_RIGHT: {
+      // tempLevel gets increased or decreased by actual step size (up to 100x on fast spins)
+      int8_t   dir = (event == EV_RIGHT) ? 1 : -1;
+      uint16_t step = outputLevelStepSize;
+      for (uint8_t a = EXTRotaryAcceleration(); a && step < 100; a--) step *= 10;
+      uint16_t tempLevel2 = tempLevel + (step * dir);
+      uint16_t levelMin = (outputLevelMode == V_P2P) ? OUTPUT_LEVEL_VPP_MIN : outputLevelMinVrms;
+      uint16_t levelMax = (outputLevelMode == V_P2P) ? OUTPUT_LEVEL_VPP_MAX : outputLevelMaxVrms;
+      if (tempLevel2 >= levelMin && tempLevel2 <= levelMax) {
+        tempLevel = tempLevel2;
+      }
+      else if (step != outputLevelStepSize && tempLevel != ((dir == 1) ? levelMax : levelMin)) {
+        // fast spin stops at limit
+        tempLevel = (dir == 1) ? levelMax : levelMin;
+      }
+      else {
+        EXTBuzzerPlay(BUZZER_CLICK);
+      }
+      EXTDisplayLevel(tempLevel, outputLevelMode);
+      EXTDisplayCursor((outputLevelStepSize == V_STEPSIZE_10 ? 11 : 12),1);
+      if (inputMode == I_NORMAL && tempLevel != outputLevel) {
+        outputLevel = tempLevel;
+        setAndStoreOutputLevel();
+      }
+      break;
+    }
+    case EV_SHORT:
+    case EV_LONG:
+      if (inputMode == I_EXPLICIT && tempLevel != outputLevel) {
+        outputLevel = tempLevel;
+        setAndStoreOutputLevel();
+        EXTBuzzerPlay(BUZZER_SINGLE);
+      }
+      else if (event == EV_LONG) {
+        // toggle between Vpp & Vrms
+        setAndStoreOutputLevelMode((outputLevelMode == V_RMS) ? V_P2P : V_RMS);
+        EXTDisplayLevel(outputLevel, outputLevelMode);
+        EXTDisplayCursor((outputLevelStepSize == V_STEPSIZE_10 ? 11 : 12),1);
+      }
+      else {
+        // short press, we change step size
+        outputLevelStepSize = (outputLevelStepSize == V_STEPSIZE_10) ? V_STEPSIZE_SMALL : V_STEPSIZE_10;
+        EXTDisplayCursor((outputLevelStepSize == V_STEPSIZE_10 ? 11 : 12),1);
+      }
+      break;
+    case EV_SELECT:
+      if (tempLevel != outputLevel) EXTDisplayLevel(outputLevel, outputLevelMode);
+      enterFrequency();
+      break;
+    default: break;
+  }
 }
 
-// re-start timer 2
-#define Timer2Clear() {\
-  timer2 = 0;\
-  systemIdleTime = 0;\
+static void frequency1Handler(uint8_t event)
+{
+  // changing output frequency (selecting digits)
+  switch (event) {
+    case EV_IDLE:
+      systemState = M_IDLE;
+      HALLcdCursor(0);
+      if (outputFrequency < MIN_FREQ) {
+        outputFrequency = OUTPUT_FREQU_DEFAULT;
+        setAndStoreOutputFrequency();
+        EXTBuzzerPlay(BUZZER_ERROR);
+      }
+      displayFrequency();
+      break;
+    case EV_LEFT:
+      // next higher digit
+      if (tempDigit < 100000UL * DDS_HZ) tempDigit *= 10;
+      frequencyCursor();
+      break;
+    case EV_RIGHT:
+      if (tempDigit > 1) tempDigit /= 10;
+      frequencyCursor();
+      break;
+    case EV_SHORT:
+    case EV_LONG:
+      systemState = M_FREQUENCY2;
+      EXTDisplayFrequency(outputFrequency,tempDigit);
+      frequencyCursor();
+      HALLcdBlink(1);
+      break;
+    case EV_SELECT:
+      leaveFrequency();
+      break;
+    default: break;
+  }
 }
 
-// timer 2 overflow interrupt routine
-ISR(TIMER2_OVF_vect){
-  if (timer2++ > 60) {            // ca. 1 sec over ?
-    timer2 = 0;
-    systemIdleTime++;
+static void frequency2Handler(uint8_t event)
+{
+  // changing output frequency (changing digits)
+  switch (event) {
+    case EV_IDLE:
+      systemState = M_IDLE;
+      HALLcdCursor(0);
+      if (outputFrequency < MIN_FREQ) {
+        outputFrequency = OUTPUT_FREQU_DEFAULT;
+        setAndStoreOutputFrequency();
+        EXTBuzzerPlay(BUZZER_ERROR);
+      }
+      displayFrequency();
+      break;
+    case EV_LEFT:
+    case EV_RIGHT: {
+      // selected digit gets changed, fast spins change higher digits too (up to 10^6 x digit)
+      uint32_t step = tempDigit;
+      for (uint8_t a = EXTRotaryAcceleration(); a && step < 1000000UL * DDS_HZ; a--) step *= 10;
+      if (event == EV_LEFT) {
+        temp = tempFrequency - step;
+        if (temp >= 0) tempFrequency = temp;
+        else if (step != tempDigit) tempFrequency = MIN_FREQ;   // fast spin stops at 0.1Hz
+      }
+      else {
+        temp = tempFrequency + step;
+        if (temp <= ((outputWaveform==SQUARE)?MAX_FREQ_TTL:MAX_FREQ) * DDS_HZ) {
+          tempFrequency = temp;
+        }
+        else if (step != tempDigit) {
+          tempFrequency = ((outputWaveform==SQUARE)?MAX_FREQ_TTL:MAX_FREQ) * DDS_HZ;
+        }
+      }
+      EXTDisplayFrequency(tempFrequency,tempDigit);
+      HALLcdBlink(1);
+      frequencyCursor();
+      if (inputMode == I_NORMAL && tempFrequency != outputFrequency) {
+        outputFrequency = tempFrequency;
+        setAndStoreOutputFrequency();
+      }
+      break;
+    }
+    case EV_SHORT:
+    case EV_LONG:
+      systemState = M_FREQUENCY1;
+      if (inputMode == I_EXPLICIT && tempFrequency != outputFrequency) {
+        outputFrequency = tempFrequency;
+        setAndStoreOutputFrequency();
+        EXTBuzzerPlay(BUZZER_SINGLE);
+#ifdef USE_SERIAL
+        Serial.print(F("Frequency: "));
+        remotePrintFixed(outputFrequency);
+#endif
+      }
+      EXTDisplayFrequency(outputFrequency,0);
+      HALLcdCursor(1);
+      HALLcdBlink(0);
+      frequencyCursor();
+      break;
+    case EV_SELECT:
+      leaveFrequency();
+      break;
+    default: break;
   }
 }
 
-//
-// some function definitions
-//
-static void SPIInit(void)
+static void presetHandler(uint8_t event)
 {
-  digitalWrite(PIN_PB1, HIGH);    // chip select signal for DAC AD5452 set high
-  pinMode(PIN_PB1, OUTPUT);       // chip select port for DAC AD5452 set to output
-  SPI.begin();                    // SPI SS pin is CS signal for AD9833, will be high
+  // selecting preset, short press recalls it, long press saves actual settings into it
+  switch (event) {
+    case EV_IDLE:
+    case EV_SELECT:
+      systemState = M_IDLE;
+      displayOutputSettings();
+      break;
+    case EV_LEFT:
+    case EV_RIGHT:
+      presetSlot = (presetSlot + PER_PRESETS + ((event == EV_RIGHT) ? 1 : -1)) % PER_PRESETS;
+      displayPreset(presetSlot);
+      break;
+    case EV_LONG:
+      systemState = M_IDLE;
+      savePreset(presetSlot);
+      EXTBuzzerPlay(BUZZER_DOUBLE);
+      displayOutputSettings();
+      break;
+    case EV_SHORT:
+      systemState = M_IDLE;
+      if (recallPreset(presetSlot)) {
+        EXTBuzzerPlay(BUZZER_SINGLE);
+      }
+      else {
+        EXTBuzzerPlay(BUZZER_ERROR);
+        displayOutputSettings();
+      }
+      break;
+    default: break;
+  }
 }
 
-static void setAndStoreOutputLevel()
+#ifdef USE_SWEEP
+static void sweepHandler(uint8_t event)
 {
-  EXTDacSetLevel(outputLevel, outputWaveform, outputLevelMode);
-  eeprom_busy_wait();
-  eeprom_update_word(&eLevel,outputLevel);
+  // selecting (M_SWEEP1) or changing (M_SWEEP2) sweep parameters
+  int8_t dir = (event == EV_RIGHT) ? 1 : -1;
+
+  switch (event) {
+    case EV_IDLE:
+      systemState = M_IDLE;
+      HALLcdCursor(0);
+      HALLcdBlink(0);
+      displayOutputSettings();
+      break;
+    case EV_LEFT:
+    case EV_RIGHT:
+      if (systemState == M_SWEEP1) {
+        // select next/previous parameter
+        if (dir == -1 && sweepField > SF_LAW) sweepField--;
+        else if (dir == 1 && sweepField < SF_STOP) sweepField++;
+      }
+      else {
+        switch (sweepField) {
+          case SF_LAW:
+            if (dir == -1) tempSweepLaw = (tempSweepLaw == SWEEP_OFF) ? SWEEP_LOG : tempSweepLaw - 1;
+            else tempSweepLaw = (tempSweepLaw == SWEEP_LOG) ? SWEEP_OFF : tempSweepLaw + 1;
+            break;
+          case SF_STEPS:
+            temp = tempSweepSteps + dir;
+            if (temp >= SWEEP_STEPS_MIN && temp <= SWEEP_STEPS_MAX) tempSweepSteps = temp;
+            break;
+          case SF_DWELL:
+            tempSweepDwell = step125(tempSweepDwell, dir, SWEEP_DWELL_MIN, SWEEP_DWELL_MAX);
+            break;
+          case SF_STOP:
+            tempSweepStop = step125(tempSweepStop, dir, 1, (outputWaveform == SQUARE) ? MAX_FREQ_TTL : MAX_FREQ);
+            break;
+          default: break;
+        }
+        EXTDisplaySweep(tempSweepLaw, tempSweepSteps, tempSweepDwell, tempSweepStop);
+        if (inputMode == I_NORMAL) {
+          sweepLaw = tempSweepLaw;
+          sweepStopFrequency = tempSweepStop;
+          sweepStepNumber = tempSweepSteps;
+          sweepDwell = tempSweepDwell;
+          setAndStoreSweep();
+        }
+      }
+      EXTDisplayCursor(sweepFieldCol[sweepField],sweepFieldRow[sweepField]);
+      break;
+    case EV_SHORT:
+    case EV_LONG:
+      if (systemState == M_SWEEP1) {
+        systemState = M_SWEEP2;
+        HALLcdBlink(1);
+      }
+      else {
+        systemState = M_SWEEP1;
+        if (inputMode == I_EXPLICIT) {
+          sweepLaw = tempSweepLaw;
+          sweepStopFrequency = tempSweepStop;
+          sweepStepNumber = tempSweepSteps;
+          sweepDwell = tempSweepDwell;
+          setAndStoreSweep();
+          EXTBuzzerPlay(BUZZER_DOUBLE);
+        }
+        HALLcdBlink(0);
+      }
+      EXTDisplayCursor(sweepFieldCol[sweepField],sweepFieldRow[sweepField]);
+      break;
+    case EV_SELECT:
+      displayOutputSettings();
+      HALLcdCursor(0);
+      enterWaveform();
+      break;
+    default: break;
+  }
 }
+#endif
 
-static void setAndStoreOutputFrequency()
+#ifdef USE_COUNTER
+static void counterHandler(uint8_t event)
 {
-  DDSFreq(outputFrequency);
-  eeprom_busy_wait();
-  eeprom_update_dword(&eFrequency,outputFrequency);
-}            
+  // showing measured frequency, long press calibrates MCLK with own TTL output fed back to T1
+  uint32_t edges, mclk;
+
+  switch (event) {
+    case EV_COUNT:
+      edges = EXTCounterGet();
+      if (!counterCalibrating) {
+        EXTDisplayCounter((edges * 25 + 8) / 16 * DDS_HZ, 0, DDSClockGet());
+        break;
+      }
+      counterCalibrating = 0;
+      mclk = DDSClockMeasured(outputFrequency, edges);
+      if (mclk < AD9833_MCLK - AD9833_MCLK_TOL || mclk > AD9833_MCLK + AD9833_MCLK_TOL) {
+        // no or wrong signal at T1
+        EXTBuzzerPlay(BUZZER_ERROR);
+      }
+      else {
+        DDSClockSet(mclk);
+        storeClock();
+        DDSFreq(outputFrequency);   // counter shows corrected frequency from now on
+        EXTBuzzerPlay(BUZZER_DOUBLE);
+      }
+      EXTCounterStart(COUNTER_GATE);
+      EXTDisplayCounter((edges * (DDS_HZ / 4) + 2) / 4, 0, DDSClockGet());   // 1/16 Hz resolution
+      break;
+    case EV_LONG:
+      if (!outputEnabled || outputWaveform != SQUARE || outputFrequency < CAL_FREQU_MIN * DDS_HZ) {
+        EXTBuzzerPlay(BUZZER_ERROR);
+        break;
+      }
+      counterCalibrating = 1;
+      EXTCounterStart(COUNTER_GATE_CAL);
+      EXTDisplayCounter(0, 1, DDSClockGet());
+      break;
+    case EV_SHORT:
+    case EV_SELECT:
+      leaveCounter();
+      break;
+    default: break;
+  }
+}
+#endif
+
+// handler of each state (index is M_xxx)
+static const stateHandler stateHandlers[] PROGMEM = {
+  idleHandler,                        // M_IDLE
+  waveformHandler,                    // M_WAVEFORM
+  levelHandler,                       // M_LEVEL
+  frequency1Handler,                  // M_FREQUENCY1
+  frequency2Handler,                  // M_FREQUENCY2
+#ifdef USE_SWEEP
+  sweepHandler,                       // M_SWEEP1
+  sweepHandler,                       // M_SWEEP2
+#else
+  idleHandler,                        // M_SWEEP1 (not used)
+  idleHandler,                        // M_SWEEP2 (not used)
+#endif
+  presetHandler,                      // M_PRESET
+#ifdef USE_COUNTER
+  counterHandler                      // M_COUNTER
+#endif
+};
 
 //
 // runs once after power on
@@ -159,24 +1934,41 @@ void setup() {
 
   EXTSelectSwitchInit();
   EXTRotaryInit();
-  if (EXTRotaryButtonCheck()) {
+  EXTTickInit();
+  HALDelay(10);                                 // buttons debounced
+  if (EXTRotaryButtonPressed()) {
     // encoder button was pressed during power on
     inputMode = I_EXPLICIT;
   }
 
   // read stored parameters from EEPROM and check validity
-  eeprom_busy_wait();
-  outputWaveform = eeprom_read_byte(&eWaveform);
+  perSettings settings;
+  if (PERLoad(&settings)) {
+    outputWaveform = settings.waveform;
+    outputFrequency = settings.frequency;
+    outputLevel = settings.level;
+    outputLevelMode = settings.levelMode;
+  }
+  else {
+    // no record yet, settings of former firmware
+    HALEepromWait();
+    outputWaveform = HALEepromReadByte(&eWaveform);
+    HALEepromWait();
+    outputFrequency = HALEepromReadDword(&eFrequency);   // Hz
+    outputFrequency = (outputFrequency <= MAX_FREQ_TTL) ? outputFrequency * DDS_HZ : 0;
+    HALEepromWait();
+    outputLevel = HALEepromReadWord(&eLevel);
+    HALEepromWait();
+    outputLevelMode = HALEepromReadByte(&eLevelMode);
+  }
   if (outputWaveform != SINUS && outputWaveform != TRIANGLE && outputWaveform != SQUARE) {
     outputWaveform = SINUS;
   }
-  eeprom_busy_wait();
-  outputFrequency = eeprom_read_dword(&eFrequency);
-  if (outputFrequency < 1 || outputFrequency > ((outputWaveform == SQUARE) ? MAX_FREQ_TTL : MAX_FREQ)) {
+  outputLevelMaxVrms = (outputWaveform == TRIANGLE) ? V_RMS_MAX_TRI : V_RMS_MAX_SIN;
+  outputLevelMinVrms = (outputWaveform == TRIANGLE) ? V_RMS_MIN_TRI : V_RMS_MIN_SIN;
+  if (outputFrequency < MIN_FREQ || outputFrequency > ((outputWaveform == SQUARE) ? MAX_FREQ_TTL : MAX_FREQ) * DDS_HZ) {
     outputFrequency = OUTPUT_FREQU_DEFAULT;
   }
-  eeprom_busy_wait();
-  outputLevel = eeprom_read_word(&eLevel);
   if (/*outputLevel < 10 || */outputLevel > OUTPUT_LEVEL_VPP_MAX) {
     // set default output level
     outputLevel = OUTPUT_LEVEL_DEFAULT;
@@ -186,54 +1978,152 @@ void setup() {
     outputLevel /= 10;
     outputLevel *= 10;
   }
-  eeprom_busy_wait();
-  outputLevelMode = eeprom_read_byte(&eLevelMode);
   if (outputLevelMode != V_RMS && outputLevelMode != V_P2P) {
     // set default output level mode
     outputLevelMode = OUTPUT_LEVEL_MODE_DEFAULT;
   }
+#ifdef USE_SWEEP
+  HALEepromWait();
+  sweepLaw = HALEepromReadByte(&eSweepLaw);
+  if (sweepLaw != SWEEP_OFF && sweepLaw != SWEEP_LIN && sweepLaw != SWEEP_LOG) {
+    sweepLaw = SWEEP_LAW_DEFAULT;
+  }
+  HALEepromWait();
+  sweepStopFrequency = HALEepromReadDword(&eSweepStop);
+  if (sweepStopFrequency < 1 || sweepStopFrequency > MAX_FREQ_TTL) {
+    sweepStopFrequency = SWEEP_STOP_DEFAULT;
+  }
+  HALEepromWait();
+  sweepStepNumber = HALEepromReadByte(&eSweepSteps);
+  if (sweepStepNumber < SWEEP_STEPS_MIN || sweepStepNumber > SWEEP_STEPS_MAX) {
+    sweepStepNumber = SWEEP_STEPS_DEFAULT;
+  }
+  HALEepromWait();
+  sweepDwell = HALEepromReadWord(&eSweepDwell);
+  if (sweepDwell < SWEEP_DWELL_MIN || sweepDwell > SWEEP_DWELL_MAX) {
+    sweepDwell = SWEEP_DWELL_DEFAULT;
+  }
+#endif
+#ifdef USE_MODULATION
+  HALEepromWait();
+  modType = HALEepromReadByte(&eModType);
+  if (modType > MOD_OOK) {
+    modType = MOD_TYPE_DEFAULT;
+  }
+  HALEepromWait();
+  modBaud = HALEepromReadWord(&eModBaud);
+  if (modBaud < MOD_BAUD_MIN || modBaud > MOD_BAUD_MAX) {
+    modBaud = MOD_BAUD_DEFAULT;
+  }
+  HALEepromWait();
+  modFrequency = HALEepromReadDword(&eModFrequency);
+  if (modFrequency < 1 || modFrequency > MAX_FREQ_TTL) {
+    modFrequency = MOD_FREQU_DEFAULT;
+  }
+  HALEepromWait();
+  modPhase = HALEepromReadWord(&eModPhase);
+  if (modPhase >= 360) {
+    modPhase = MOD_PHASE_DEFAULT;
+  }
+  HALEepromWait();
+  modLength = HALEepromReadWord(&eModLength);
+  if (modLength > MOD_BITS_MAX) {
+    modLength = 0;
+  }
+  HALEepromWait();
+  HALEepromReadBlock(modPattern,eModPattern,MOD_PATTERN_BYTES);
+#endif
+#ifdef USE_ENVELOPE
+  HALEepromWait();
+  envShape = HALEepromReadByte(&eEnvShape);
+  if (envShape > ENV_ADSR) {
+    envShape = ENV_SHAPE_DEFAULT;
+  }
+  HALEepromWait();
+  envDepth = HALEepromReadByte(&eEnvDepth);
+  if (envDepth > ENV_DEPTH_MAX) {
+    envDepth = ENV_DEPTH_DEFAULT;
+  }
+  HALEepromWait();
+  envRate = HALEepromReadWord(&eEnvRate);
+  if (envRate < ENV_RATE_MIN || envRate > ENV_RATE_MAX) {
+    envRate = ENV_RATE_DEFAULT;
+  }
+#endif
+#ifdef USE_COUNTER
+  HALEepromWait();
+  DDSClockSet(HALEepromReadDword(&eMclk));      // ignored if erased or out of range
+#endif
+#if DDS_CHANNELS > 1
+  for (uint8_t ch = 0; ch < DDS_CHANNELS; ch++) {
+    HALEepromWait();
+    chanPhase[ch] = HALEepromReadWord(&eChanPhase[ch]);
+    if (chanPhase[ch] >= 360) chanPhase[ch] = 0;
+  }
+#endif
+#ifdef USE_BURST
+  HALEepromWait();
+  burstMode = HALEepromReadByte(&eBurstMode);
+  if (burstMode > BURST_EXT) {
+    burstMode = BURST_MODE_DEFAULT;
+  }
+  HALEepromWait();
+  burstCycles = HALEepromReadWord(&eBurstCycles);
+  if (burstCycles < BURST_CYCLES_MIN) {
+    burstCycles = BURST_CYCLES_DEFAULT;
+  }
+  HALEepromWait();
+  burstPeriod = HALEepromReadWord(&eBurstPeriod);
+  if (burstPeriod < BURST_PERIOD_MIN || burstPeriod > BURST_PERIOD_MAX) {
+    burstPeriod = BURST_PERIOD_DEFAULT;
+  }
+#endif
 
   // Initialize LCD module, Cursor not visible
-  lcd.init();
-  lcd.backlight();
+  HALLcdInit();
 
   // Power on message
-  lcd.print("DDS Function Ge-");
-  lcd.setCursor(0,1);                           // go to the next line
-  lcd.print("nerator (AD9833)");
-  delay(2500);
+  HALLcdText("DDS Function Ge-");
+  HALLcdGoto(0,1);                              // go to the next line
+  HALLcdText("nerator (AD9833)");
+  HALDelay(2500);
 
   // Display frequency range
-  lcd.clear();
-  lcd.print("Range:1Hz-0.5MHz");
-  lcd.setCursor(0,1);
-  lcd.print("TTL:  1Hz-5.0MHz");
-  lcd.noCursor();
-  delay(2500);
+  HALLcdClear();
+  HALLcdText("Range:.1Hz-.5MHz");
+  HALLcdGoto(0,1);
+  HALLcdText("TTL:  .1Hz-5MHz");
+  HALLcdCursor(0);
+  HALDelay(2500);
 
    // If button press needed to activate new values then give info
   if (inputMode == I_EXPLICIT) {
-    lcd.clear();
-    lcd.print("Pressing button ");
-    lcd.setCursor(0,1);
-    lcd.print("changes value!");
-    lcd.noCursor();
-    delay(2500);
+    HALLcdClear();
+    HALLcdText("Pressing button ");
+    HALLcdGoto(0,1);
+    HALLcdText("changes value!");
+    HALLcdCursor(0);
+    HALDelay(2500);
   }
 
   // set display to default
-  lcd.clear();
-  lcd.noCursor();
+  EXTDisplayClear();
+  HALLcdCursor(0);
 
   SPIInit();
   EXTRelaisInit();
   EXTBuzzerInit();
   EXTDacInit();
+#ifdef USE_FLATNESS
+  for (uint8_t n = 0; n < FLAT_POINTS; n++) {
+    HALEepromWait();
+    EXTDacFlatnessSet(n, HALEepromReadWord(&eFlatness[n]));  // invalid (e.g. erased) gets 1.0
+  }
+#endif
   DDSInit();
-  Timer2Init();
   
   EXTDacSetLevel(outputLevel, outputWaveform, outputLevelMode);
-  EXTDisplayFrequency(outputFrequency,0);
+  displayFrequency();
   EXTDisplayWaveform(outputWaveform);
   if (outputWaveform != SQUARE) {
     EXTDisplayLevel(outputLevel, outputLevelMode);
@@ -241,381 +2131,78 @@ void setup() {
   }
   else {
     EXTRelaisOnOff(RELAIS_ON);
-    delay(10);
+    HALDelay(10);
   }
 
-  DDSFreq(outputFrequency);
-  //delay(1);
-  DDSSignal(outputWaveform); 
+  DDSSetup(outputWaveform, outputFrequency);   // frequency & waveform in one SPI burst
+#if DDS_CHANNELS > 1
+  syncChannels();
+#endif
+#ifdef USE_SWEEP
+  if (sweepLaw != SWEEP_OFF) {
+    startSweep();
+    EXTDisplaySweepState(sweepLaw);
+  }
+#endif
+#ifdef USE_MODULATION
+  if (modType != MOD_OFF) startModulation();
+#endif
+#ifdef USE_BURST
+  if (burstMode != BURST_OFF) startBurst();
+#endif
+#ifdef USE_ENVELOPE
+  startEnvelope();
+#endif
 
 #ifdef USE_WDT
-  wdt_enable(WDTO_4S);                          // Enable Watchdog (4 sek.)
-  wdt_reset();
+  HALWatchdogStart();                           // Enable Watchdog (4 sek.), interrupt first, then reset
 #endif
   //sei();                                      // enable global interrupts - done in framework
 #ifdef USE_SERIAL
   Serial.println(F("Programmstart ok."));  
+#endif
+  // drop button events from power on phase
+  EXTEventFlush();
+  EXTDisplayFlush();
+#ifdef USE_BENCH
+  BCHRun();                                     // bench firmware: count cycles, then halt
 #endif
 }
 
 void loop() {
   // put your main code here, to run repeatedly:
+  uint8_t event;
+  PROBE_START(loopStart);
+
 #ifdef USE_WDT
-  wdt_reset();                                  // reset watchdog
+  HALWatchdogReset();                           // reset watchdog
 #endif  
-  if (systemState == M_IDLE) {
-    // we are idle and only check select switch
-    if (EXTSelectSwitchCheck()) {
-      systemState = M_WAVEFORM;
-      rotaryImpulseLeft = rotaryImpulseRight = 0;
-      tempWaveform = outputWaveform;
-      lcd.setCursor(0,1);
-      lcd.blink();
-      Timer2Start();
-    }
-  }
-  else if (systemState == M_WAVEFORM) {
-    // selecting waveform
-    if (systemIdleTime >= MAX_IDLE_TIME) {
-      systemState = M_IDLE;
-      Timer2Stop();
-      lcd.noCursor();
-      if (tempWaveform != outputWaveform) EXTDisplayWaveform(outputWaveform);	
-      if (outputWaveform != SQUARE ) EXTDisplayLevel(outputLevel, outputLevelMode);
-    }
-    else if ((ret = EXTRotaryImpulseCheck()) != 0) {
-      Timer2Clear();
-      if (ret == -1) {
-        switch (tempWaveform) {
-          case SINUS:	tempWaveform = SQUARE; break;
-          case SQUARE: tempWaveform = TRIANGLE; break;
-          default: tempWaveform = SINUS; break;
-        }
-      }
-      else {
-        switch (tempWaveform) {
-          case SINUS:	tempWaveform = TRIANGLE; break;
-          case TRIANGLE: tempWaveform = SQUARE; break;
-          default: tempWaveform = SINUS; break;
-        }
-      }
-      if (inputMode == I_NORMAL) {
-        goto JUMP1;
-      }
-      else {
-        EXTDisplayWaveform(tempWaveform);
-        if (tempWaveform != SQUARE) EXTDisplayLevel(outputLevel, outputLevelMode);
-        lcd.setCursor(0,1);
-      }
-    }
-    else if (EXTRotaryButtonCheck()) {
-JUMP1:
-      Timer2Clear();
-      if (tempWaveform != outputWaveform) {
-        outputWaveform = tempWaveform;
-        EXTDisplayWaveform(outputWaveform);
-        DDSSignal(outputWaveform); 
-        if (tempWaveform != SQUARE) {
-          // new selected waveform is sinus or triangle
-          outputLevelMaxVrms = (outputWaveform == SINUS) ? V_RMS_MAX_SIN : V_RMS_MAX_TRI;
-          outputLevelMinVrms = (outputWaveform == SINUS) ? V_RMS_MIN_SIN : V_RMS_MIN_TRI;
-          if (outputLevelMode != V_P2P && outputLevelMaxVrms < outputLevel) {
-            // max Vrms has been reduced (change from SINUS to TRIANGLE)
-            outputLevel = outputLevelMaxVrms;
-          }
-          else if (outputLevelMode != V_P2P && outputLevel < outputLevelMinVrms) {
-            outputLevel = outputLevelMinVrms;
-          }
-          tempLevel = outputLevel;
-          setAndStoreOutputLevel();
-          EXTDisplayLevel(outputLevel, outputLevelMode);
-          if (outputFrequency > MAX_FREQ) {
-            // happens when waveform switched from TTL to SINUS/TRIANGLE
-            outputFrequency = MAX_FREQ;
-            setAndStoreOutputFrequency();
-            EXTDisplayFrequency(outputFrequency,0);	
-          }
-        }
-        eeprom_busy_wait();
-        eeprom_update_byte(&eWaveform,outputWaveform);
-        EXTRelaisOnOff((outputWaveform == SQUARE)?RELAIS_ON:RELAIS_OFF);
-        if (inputMode == I_EXPLICIT) EXTBuzzerRing(80);
-      }
-      lcd.setCursor(0,1);
-    } 
-    else if (EXTSelectSwitchCheck()) {
-      Timer2Clear();
-      if (tempWaveform != outputWaveform) EXTDisplayWaveform(outputWaveform);	
-      if (outputWaveform != SQUARE) {
-        // output level can only be changed for sinus and triangle waveform
-        systemState = M_LEVEL;
-        tempLevel = outputLevel;
-        EXTDisplayLevel(outputLevel, outputLevelMode);
-        lcd.setCursor((outputLevelStepSize == V_STEPSIZE_10 ? 11 : 12),1);
-        lcd.blink();
-      }
-      else {
-        // square was selected -> TTL level can't be changed
-        systemState = M_FREQUENCY1;
-        tempFrequency = outputFrequency;
-        if (tempFrequency >= 1000000) {
-          tempDigit = 100000;
-          lcd.setCursor(6,0);
-        }
-        else {
-          tempDigit = 1000;
-          lcd.setCursor(8,0);
-        }
-        lcd.cursor();
-        lcd.noBlink();
-      }
-    }
-  }
-  else if (systemState == M_LEVEL) {
-    // changing output level (sinus & triangle)
-    if (systemIdleTime >= MAX_IDLE_TIME) {
-      systemState = M_IDLE;
-      Timer2Stop();
-      lcd.noCursor();
-      lcd.noBlink();
-      if (tempLevel != outputLevel) EXTDisplayLevel(outputLevel, outputLevelMode);	
-    }
-    else if ((ret = EXTRotaryImpulseCheck()) != 0) {
-      Timer2Clear();
-      // tempLevel gets increased or decreased by actual step size
-      uint16_t tempLevel2 = tempLevel + (outputLevelStepSize * ret);
-      if (tempLevel2 >= ((outputLevelMode == V_P2P) ? OUTPUT_LEVEL_VPP_MIN : outputLevelMinVrms) && 
-          tempLevel2 <= ((outputLevelMode == V_P2P) ? OUTPUT_LEVEL_VPP_MAX : outputLevelMaxVrms)) {
-        tempLevel = tempLevel2;
-      }
-      else {
-        EXTBuzzerRing(10);
-      }
-      EXTDisplayLevel(tempLevel, outputLevelMode);
-      lcd.setCursor((outputLevelStepSize == V_STEPSIZE_10 ? 11 : 12),1);
-      if (inputMode == I_NORMAL && tempLevel != outputLevel) {
-        outputLevel = tempLevel;
-        setAndStoreOutputLevel();
-      }
-    }
-    else if ((event = EXTRotaryButtonCheck()) != idle) {
-      Timer2Clear();
-      if (inputMode == I_EXPLICIT && tempLevel != outputLevel) {
-        outputLevel = tempLevel;
-        setAndStoreOutputLevel();
-        EXTBuzzerRing(80);
-      }
-      else {
-        if (event == longPress) {
-          // toggle between Vpp & Vrms, output level might slightly change due to rounding & casting
-          outputLevelMode = (outputLevelMode == V_RMS) ? V_P2P : V_RMS;
-          if (outputLevelMode == V_RMS) {
-            // converting output level from Vpp to Vrms
-            outputLevel = (uint16_t)(outputLevel / (2 * (double)((outputWaveform == SINUS) ? SQRT2 : SQRT3)));
-            if (outputLevelMaxVrms < outputLevel) outputLevel = outputLevelMaxVrms;
-            if (outputLevel < outputLevelMinVrms) outputLevel = outputLevelMinVrms;
-          }
-          else {
-            // converting output level from Vrms to Vpp (add 0.8 to minimize conversion errors),
-            outputLevel = (uint16_t)((outputLevel * 2 * (double)((outputWaveform == SINUS) ? SQRT2 : SQRT3)) + 0.8);
-            if (OUTPUT_LEVEL_VPP_MAX < outputLevel) outputLevel = OUTPUT_LEVEL_VPP_MAX;
-            if (outputLevel < OUTPUT_LEVEL_VPP_MIN) outputLevel = OUTPUT_LEVEL_VPP_MIN;
-          }
-          tempLevel = outputLevel;
-          EXTDisplayLevel(outputLevel, outputLevelMode);
-          lcd.setCursor((outputLevelStepSize == V_STEPSIZE_10 ? 11 : 12),1);
-          setAndStoreOutputLevel();
-          eeprom_busy_wait();
-          eeprom_update_byte(&eLevelMode,outputLevelMode);
-        }
-        else {
-          // shortPress, we change step size
-          outputLevelStepSize = (outputLevelStepSize == V_STEPSIZE_10) ? V_STEPSIZE_SMALL : V_STEPSIZE_10;
-          lcd.setCursor((outputLevelStepSize == V_STEPSIZE_10 ? 11 : 12),1);
-        }
-      }
-    }
-    else if (EXTSelectSwitchCheck()) {
-      systemState = M_FREQUENCY1;
-      Timer2Clear();
-      if (tempLevel != outputLevel) EXTDisplayLevel(outputLevel, outputLevelMode);	
-      tempFrequency = outputFrequency;
-      if (tempFrequency >= 1000000) {
-        tempDigit = 100000;
-        lcd.setCursor(6,0);
-      }
-      else {
-        tempDigit = 1000;
-        lcd.setCursor(8,0);
-      }
-      lcd.cursor();
-      lcd.noBlink();
+#ifdef USE_SERIAL
+  remotePoll();
+#endif
+  while ((event = EXTEventGet()) != EV_NONE) {
+    if (event == EV_PERSIST) {
+      // no setting changes for PERSIST_DELAY ms, try again later if record log still busy
+      if (PERBusy()) EXTTimerStart(TIMER_PERSIST, PERSIST_DELAY);
+      else if (settingsDirty) storeSettings();
+      continue;
     }
-  }
-  else if (systemState == M_FREQUENCY1) {
-    // changing output frequency (selecting digits)
-    if (systemIdleTime >= MAX_IDLE_TIME) {
-      systemState = M_IDLE;
-      Timer2Stop();
-      lcd.noCursor();
-      if (outputFrequency == 0) {
-        outputFrequency = OUTPUT_FREQU_DEFAULT;
-        EXTDisplayFrequency(outputFrequency,0);
-        setAndStoreOutputFrequency();
-        EXTBuzzerRing(80);
-      }
-      else if (tempFrequency != outputFrequency) {
-        EXTDisplayFrequency(outputFrequency,0);	
-      }
-    }
-    else if ((ret = EXTRotaryImpulseCheck()) != 0) {
-      Timer2Clear();
-      switch (tempDigit) {
-        case 1:
-          if (ret == -1) { tempDigit = 10; lcd.setCursor(11,0); }
-          break;
-        case 10:
-          if (ret == -1) { tempDigit = 100; lcd.setCursor(10,0); }
-          else { tempDigit = 1; lcd.setCursor(12,0); }
-          break;
-        case 100:
-          if (ret == -1) { tempDigit = 1000; lcd.setCursor(8,0); }
-          else { tempDigit = 10; lcd.setCursor(11,0); }
-          break;
-        case 1000:
-          if (ret == -1) { tempDigit = 10000; lcd.setCursor(7,0); }
-          else { tempDigit = 100; lcd.setCursor(10,0); }
-          break;
-        case 10000:
-          if (ret == -1) { tempDigit = 100000; lcd.setCursor(6,0); }
-          else { tempDigit = 1000; lcd.setCursor(8,0); }
-          break;
-        case 100000:
-          if (ret == 1) { tempDigit = 10000; lcd.setCursor(7,0); }
-          break;
-        default: break;
-      }
-    }
-    else if (EXTRotaryButtonCheck()) {
-      systemState = M_FREQUENCY2;
-      Timer2Clear();
-      if (tempDigit == 10000) {
-        EXTDisplayFrequency(outputFrequency,1);
-        lcd.setCursor(7,0);
-      }
-      else if (tempDigit == 100000) {
-        EXTDisplayFrequency(outputFrequency,2);
-        lcd.setCursor(6,0);
-      }
-      lcd.blink();
-    }
-    else if (EXTSelectSwitchCheck()) {
-      systemState = M_WAVEFORM;
-      Timer2Clear();
-      rotaryImpulseLeft = rotaryImpulseRight = 0;
-      if (outputFrequency == 0) {
-        outputFrequency = OUTPUT_FREQU_DEFAULT;
-        setAndStoreOutputFrequency();
-        EXTBuzzerRing(80);
-      }
-      EXTDisplayFrequency(outputFrequency,0);
-      tempWaveform = outputWaveform;
-      lcd.setCursor(0,1);
-      lcd.blink();
+    if (event < EV_TIMER) PROBE_SINCE(PRB_DISPATCH);
+    ((stateHandler)pgm_read_ptr(&stateHandlers[systemState]))(event);
+    if (event < EV_TIMER) {
+      PROBE_UNMARK();
+      // any input restarts the idle timeout
+      if (systemState != M_IDLE) IdleTimerStart();
+      else IdleTimerStop();
     }
   }
-  else if (systemState == M_FREQUENCY2) {
-    // changing output frequency (changing digits)
-    if (systemIdleTime >= MAX_IDLE_TIME) {
-      systemState = M_IDLE;
-      Timer2Stop();
-      lcd.noCursor();
-      if (outputFrequency == 0) {
-        outputFrequency = OUTPUT_FREQU_DEFAULT;
-        setAndStoreOutputFrequency();
-        EXTBuzzerRing(80);
-      }
-      EXTDisplayFrequency(outputFrequency,0);	
-    }
-    else if ((ret = EXTRotaryImpulseCheck()) != 0) {
-      Timer2Clear();
-      if (ret == -1) {
-        temp = tempFrequency - tempDigit;
-        if (temp >= 0) tempFrequency -= tempDigit;
-      }
-      else {
-        temp = tempFrequency + tempDigit;
-        if (temp <= ((outputWaveform==SQUARE)?MAX_FREQ_TTL:MAX_FREQ)) {
-          tempFrequency += tempDigit;
-        }
-      }
-      if (tempDigit == 10000) EXTDisplayFrequency(tempFrequency,1);
-      else if (tempDigit == 100000) EXTDisplayFrequency(tempFrequency,2);
-      else EXTDisplayFrequency(tempFrequency,0);
-      lcd.blink();
-      switch ( tempDigit ) {
-        case 1:
-          lcd.setCursor(12,0); break;
-        case 10:
-          lcd.setCursor(11,0); break;
-        case 100:
-          lcd.setCursor(10,0); break;
-        case 1000:
-          lcd.setCursor(8,0); break;
-        case 10000:
-          lcd.setCursor(7,0); break;
-        case 100000:
-          lcd.setCursor(6,0); break;
-        default: break;
-      }
-      if (inputMode == I_NORMAL && tempFrequency != outputFrequency) {
-        outputFrequency = tempFrequency;
-        setAndStoreOutputFrequency();
-      }
-    }
-    else if (EXTRotaryButtonCheck()) {
-      systemState = M_FREQUENCY1;
-      Timer2Clear();
-      if (inputMode == I_EXPLICIT && tempFrequency != outputFrequency) {
-        outputFrequency = tempFrequency;
-        setAndStoreOutputFrequency();
-        EXTBuzzerRing(80);
+  PROBE_START(flushStart);
 #ifdef USE_SERIAL
-        Serial.printf(F("Frequency: %lu"),outputFrequency);
-#endif
-      }
-      EXTDisplayFrequency(outputFrequency,0);	
-      lcd.cursor();
-      lcd.noBlink();
-      switch ( tempDigit ) {
-        case 1:
-          lcd.setCursor(12,0); break;
-        case 10:
-          lcd.setCursor(11,0); break;
-        case 100:
-          lcd.setCursor(10,0); break;
-        case 1000:
-          lcd.setCursor(8,0); break;
-        case 10000:
-          lcd.setCursor(7,0); break;
-        case 100000:
-          lcd.setCursor(6,0); break;
-        default: break;
-      }
-    }
-    else if (EXTSelectSwitchCheck()) {
-      systemState = M_WAVEFORM;
-      Timer2Clear();
-      rotaryImpulseLeft = rotaryImpulseRight = 0;
-      if (outputFrequency == 0) {
-        outputFrequency = OUTPUT_FREQU_DEFAULT;
-        setAndStoreOutputFrequency();
-        EXTBuzzerRing(80);
-      }
-      EXTDisplayFrequency(outputFrequency,0);
-      tempWaveform = outputWaveform;
-      lcd.setCursor(0,1);
-      lcd.blink();
-    }
-  }
-}
\ No newline at end of file
+  displaySaved += EXTDisplayFlush();            // only changed display cells get sent
+#else
+  EXTDisplayFlush();                            // only changed display cells get sent
+#endif
+  PROBE_STOP(PRB_FLUSH, flushStart);
+  PROBE_STOP(PRB_LOOP, loopStart);
+  EXTEventWait();                               // sleep until next interrupt
+}
@@ -0,0 +1,85 @@
+/*
+ * MODULATION.CPP: timer clocked FSK/PSK/OOK modulation for the AD9833 function generator
+ *
+ * Frequency and phase registers get preloaded when modulation is started, the two control
+ * words for bit 0 and bit 1 are precomputed. The timer 1 compare ISR then sends exactly one
+ * 16bit control word per symbol, which allows baud rates of several kHz.
+*/
+
+#include "config.h"
+#include "hal.h"
+#include "ad9833.h"
+#include "external.h"
+#include "modulation.h"
+
+#ifdef USE_MODULATION
+
+uint8_t  modPattern[MOD_PATTERN_BYTES];         // bit pattern, must not be changed while running
+uint16_t modLength = 0;                         // number of valid bits in modPattern
+
+static uint16_t modWord[2];                     // control words for bit 0 and bit 1
+static uint16_t modControl;                     // control word to restore when stopped
+static volatile uint16_t modIndex;
+static volatile uint8_t  modNext;
+
+// timer 1 compare handler, one control word per symbol (next bit prepared afterwards
+// to keep the time between interrupt and SPI write constant)
+static void MODSymbol(void)
+{
+  DDSWriteBurst(&modWord[modNext], 1);
+  if (++modIndex >= modLength) modIndex = 0;
+  modNext = (modPattern[modIndex >> 3] >> (7 - (modIndex & 7))) & 1;
+}
+
+// preloads registers and starts modulation with the actual bit pattern (repeated endlessly),
+// frequ0 is the output frequency, frequ1 the FSK frequency for bit 1, phase1 the PSK phase for bit 1
+void MODStart(uint8_t type, uint16_t baud, uint32_t frequ0, uint32_t frequ1, uint16_t phase1)
+{
+  MODStop();
+  if (type == MOD_OFF || !modLength) return;
+  baud = (baud < MOD_BAUD_MIN) ? MOD_BAUD_MIN : ((baud > MOD_BAUD_MAX) ? MOD_BAUD_MAX : baud);
+
+  // FREQ0 & PHASE0 active
+  modControl = DDSControlGet() & ~((1 << FSELECT) | (1 << PSELECT) | (1 << SLEEP12));
+  DDSFreqReg(0, frequ0);
+  DDSPhase(PHASE0, 0);
+  switch (type) {
+    case MOD_FSK:
+      DDSFreqReg(1, frequ1);
+      modWord[0] = modControl;
+      modWord[1] = modControl | (1 << FSELECT);
+      break;
+    case MOD_PSK:
+      DDSPhase(PHASE1, phase1);
+      modWord[0] = modControl;
+      modWord[1] = modControl | (1 << PSELECT);
+      break;
+    default:
+      // MOD_OOK: DAC powered down & comparator disconnected for bit 0
+      modWord[0] = (modControl | (1 << SLEEP12)) & ~(1 << OPBITEN);
+      modWord[1] = modControl;
+      break;
+  }
+  DDSControlSet(modControl);
+
+  modIndex = 0;
+  modNext = modPattern[0] >> 7;
+  // timer 1 at 2MHz, one symbol every 2000000/baud ticks
+  EXTTimer1Start(MODSymbol, T1_PRESCALER_8, (uint16_t)(2000000UL / baud - 1));
+}
+
+// stops modulation, output continues with FREQ0/PHASE0 (frequ0)
+void MODStop(void)
+{
+  if (MODRunning()) {
+    EXTTimer1Stop(MODSymbol);
+    DDSControlSet(modControl);
+  }
+}
+
+uint8_t MODRunning(void)
+{
+  return(EXTTimer1Owner(MODSymbol));
+}
+
+#endif
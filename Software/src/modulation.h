@@ -0,0 +1,29 @@
+/*
+ * MODULATION.H: timer clocked FSK/PSK/OOK modulation for the AD9833 function generator
+*/
+
+#ifndef MODULATION_H_
+#define MODULATION_H_
+
+// modulation types
+#define MOD_OFF 0
+#define MOD_FSK 1           // bit 0: FREQ0, bit 1: FREQ1 (FSELECT)
+#define MOD_PSK 2           // bit 0: PHASE0 (0 deg), bit 1: PHASE1 (PSELECT)
+#define MOD_OOK 3           // bit 0: DAC/comparator off (SLEEP12, OPBITEN), bit 1: on
+
+#define MOD_BITS_MAX      256                 // max. bit pattern length
+#define MOD_PATTERN_BYTES (MOD_BITS_MAX / 8)  // bit pattern packed MSB first
+#define MOD_BAUD_MIN      50
+#define MOD_BAUD_MAX      10000               // timer 1 with prescaler 8, ISR takes ~15us
+
+extern uint8_t  modPattern[MOD_PATTERN_BYTES];
+extern uint16_t modLength;
+
+//
+// function declarations
+//
+void    MODStart(uint8_t type, uint16_t baud, uint32_t frequ0, uint32_t frequ1, uint16_t phase1);
+void    MODStop(void);
+uint8_t MODRunning(void);
+
+#endif
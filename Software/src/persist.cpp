@@ -0,0 +1,137 @@
+/*
+ * PERSIST.CPP: wear levelled storage of the output settings for the AD9833 function generator
+ *
+ * Every store writes a new record into the next slot of a ring of PER_RECORDS records, the
+ * valid record (CRC8) with the highest sequence number is the actual one. A record torn by a
+ * power loss fails the CRC check and the previous one stays valid. The bytes get written by
+ * the EEPROM ready interrupt, so storing never blocks the main loop.
+ * Presets get stored in fixed slots as packed records, recall reads one block.
+*/
+
+#include "hal.h"
+#include "ad9833.h"
+#include "persist.h"
+
+extern uint8_t   eLog[PER_RECORDS][PER_RECORD_SIZE];
+extern perPreset ePreset[PER_PRESETS];
+extern perPresetExt ePresetExt[PER_PRESETS];
+
+static uint8_t          perSlot = PER_RECORDS - 1;   // slot of actual record
+static uint8_t          perSequence = 0xFF;
+static uint8_t          perBuffer[PER_RECORD_SIZE];  // record being written
+static volatile uint8_t perIndex = PER_RECORD_SIZE;  // next byte to write, PER_RECORD_SIZE if idle
+
+// presets: CRC8 of all bytes in front of crc (padding behind it on other targets excluded)
+#define PER_PRESET_CRC  (offsetof(perPreset, crc) + 1)
+
+// CRC8 of all bytes but the last one (CRC itself)
+static uint8_t PERCrc(const uint8_t *record, uint8_t size, uint8_t seed)
+{
+  uint8_t crc = seed;                                 // all 0xFF (erased) is no valid record
+
+  for (uint8_t i = 0; i < size - 1; i++) crc = HALCrc8(crc, record[i]);
+  return(crc);
+}
+
+// reads latest valid record, returns 0 if there is none (e.g. first start), the frequency of a
+// record written by former firmware (CRC with PER_SEED_HZ) gets converted from Hz
+uint8_t PERLoad(perSettings *settings)
+{
+  uint8_t record[PER_RECORD_SIZE];
+  uint8_t found = 0, former = 0;
+
+  for (uint8_t i = 0; i < PER_RECORDS; i++) {
+    HALEepromWait();
+    HALEepromReadBlock(record, eLog[i], PER_RECORD_SIZE);
+    uint8_t crc = record[PER_RECORD_SIZE - 1];
+    uint8_t hz = (crc != PERCrc(record, PER_RECORD_SIZE, PER_SEED));
+    if (hz && crc != PERCrc(record, PER_RECORD_SIZE, PER_SEED_HZ)) continue;
+    // sequence numbers compared modulo 256
+    if (!found || (int8_t)(record[0] - perSequence) > 0) {
+      found = 1;
+      former = hz;
+      perSlot = i;
+      perSequence = record[0];
+      memcpy(settings, &record[1], sizeof(perSettings));
+    }
+  }
+  if (former) settings->frequency = (settings->frequency <= 0xFFFFFFFFUL / DDS_HZ) ? settings->frequency * DDS_HZ : 0;
+  return(found);
+}
+
+// writes one byte per EEPROM ready interrupt, unchanged bytes get skipped,
+// returns 0 when the record is complete
+static uint8_t PERWriteNext(void)
+{
+  while (perIndex < PER_RECORD_SIZE) {
+    uint8_t *address = &eLog[perSlot][perIndex];
+    uint8_t data = perBuffer[perIndex++];
+    if (HALEepromReadByte(address) != data) {
+      HALEepromWriteByte(address, data);
+      return(1);
+    }
+  }
+  return(0);
+}
+
+// EEPROM ready interrupt routine
+ISR(EE_READY_vect)
+{
+  if (!PERWriteNext()) HALEepromIrq(0);
+}
+
+// starts writing settings as new record into the next slot, returns immediately
+void PERStore(const perSettings *settings)
+{
+  PERFlush();
+  perSlot = (perSlot + 1) % PER_RECORDS;
+  perBuffer[0] = ++perSequence;
+  memcpy(&perBuffer[1], settings, sizeof(perSettings));
+  perBuffer[PER_RECORD_SIZE - 1] = PERCrc(perBuffer, PER_RECORD_SIZE, PER_SEED);
+  perIndex = 0;
+  HALEepromIrq(1);
+}
+
+uint8_t PERBusy(void)
+{
+  return(perIndex < PER_RECORD_SIZE || !HALEepromReady());
+}
+
+// completes a record write in progress (blocking), afterwards the EEPROM can be used directly
+void PERFlush(void)
+{
+  HALEepromIrq(0);
+  do {
+    HALEepromWait();
+  } while (PERWriteNext());
+  HALEepromWait();
+}
+
+// reads preset with one EEPROM access (plus its 1/100 Hz), returns 0 if slot is empty or
+// corrupted
+uint8_t PERPresetLoad(uint8_t slot, perPreset *preset, uint8_t *centiHz)
+{
+  perPresetExt ext;
+
+  if (slot >= PER_PRESETS) return(0);
+  PERFlush();
+  HALEepromReadBlock(preset, &ePreset[slot], sizeof(perPreset));
+  if (preset->crc != PERCrc((const uint8_t *)preset, PER_PRESET_CRC, PER_SEED_HZ)) return(0);
+  HALEepromReadBlock(&ext, &ePresetExt[slot], sizeof(ext));
+  *centiHz = (ext.crc == PERCrc(&ext.centiHz, sizeof(ext), preset->crc) && ext.centiHz < DDS_HZ) ? ext.centiHz : 0;
+  return(1);
+}
+
+// stores preset (blocking, only changed bytes get written)
+void PERPresetSave(uint8_t slot, perPreset *preset, uint8_t centiHz)
+{
+  perPresetExt ext;
+
+  if (slot >= PER_PRESETS) return;
+  preset->crc = PERCrc((const uint8_t *)preset, PER_PRESET_CRC, PER_SEED_HZ);
+  ext.centiHz = centiHz;
+  ext.crc = PERCrc(&ext.centiHz, sizeof(ext), preset->crc);
+  PERFlush();
+  HALEepromUpdateBlock(preset, &ePreset[slot], sizeof(perPreset));
+  HALEepromUpdateBlock(&ext, &ePresetExt[slot], sizeof(ext));
+}
@@ -0,0 +1,58 @@
+/*
+ * PERSIST.H: wear levelled storage of the output settings for the AD9833 function generator
+*/
+
+#ifndef PERSIST_H_
+#define PERSIST_H_
+
+// record log in EEPROM (eLog in main.cpp): sequence number, settings, CRC8
+#define PER_RECORDS     16
+#define PER_RECORD_SIZE (1 + sizeof(perSettings) + 1)
+#define PER_SEED        0xA6  // CRC8 start value of records, frequency in 1/100 Hz
+#define PER_SEED_HZ     0x5A  // records of former firmware (frequency in Hz) & presets
+
+struct perSettings {
+  uint8_t  waveform;
+  uint8_t  levelMode;
+  uint16_t level;
+  uint32_t frequency;             // 1/100 Hz (records of former firmware in Hz get converted)
+};
+
+// preset slots (ePreset in main.cpp), packed records (17 instead of 26 bytes) with CRC8
+#define PER_PRESETS     8
+
+struct perPreset {
+  uint32_t frequency    : 23;   // Hz
+  uint32_t waveform     : 3;    // SINUS, SQUARE, TRIANGLE
+  uint32_t levelMode    : 1;    // V_RMS, V_P2P
+  uint32_t sweepLaw     : 2;
+  uint32_t modType      : 2;
+  uint32_t sweepStop    : 23;   // Hz
+  uint32_t sweepSteps   : 6;
+  uint32_t modFrequency : 23;   // Hz
+  uint32_t modPhase     : 9;    // deg
+  uint32_t level        : 10;   // 1/100 V
+  uint32_t sweepDwell   : 10;   // ms
+  uint16_t modBaud;
+  uint8_t  crc;
+};
+
+// 1/100 Hz of the preset frequency, kept beside the presets (ePresetExt in main.cpp) so the
+// layout of presets saved by former firmware stays valid; crc is the CRC8 of centiHz seeded with
+// the crc of its preset, so it only counts for the preset it was saved with (0 otherwise)
+struct perPresetExt {
+  uint8_t centiHz;
+  uint8_t crc;
+};
+
+//
+// function declarations
+//
+uint8_t PERLoad(perSettings *settings);
+void    PERStore(const perSettings *settings);
+uint8_t PERBusy(void);
+void    PERFlush(void);
+uint8_t PERPresetLoad(uint8_t slot, perPreset *preset, uint8_t *centiHz);
+void    PERPresetSave(uint8_t slot, perPreset *preset, uint8_t centiHz);
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ * PROBE.CPP: latency measurement for the AD9833 function generator
+ *
+ * Time stamps are taken with micros() (4us resolution, timer 0), timer 1 can't be used
+ * since it is owned by the signal engines. Every probe keeps min/avg/max and a histogram
+ * with log2 buckets in a fixed RAM budget (26 bytes per probe), times are in us and
+ * saturate at 65ms. An input event marks the start time in its ISR, the mark stays until
+ * the event has been handled, events arriving in between don't get measured.
+*/
+
+#include "config.h"
+#include "hal.h"
+#include "probe.h"
+
+#ifdef USE_PROBES
+
+static struct {
+  uint16_t min;
+  uint16_t max;
+  uint32_t sum;
+  uint16_t count;
+  uint16_t bucket[PRB_BUCKETS];
+} prbStats[PRB_PROBES];
+
+static volatile uint16_t prbMarkTime;
+static volatile uint8_t  prbMarked = 0;       // 1...mark set, 2...output already recorded
+
+static const char prbNames[PRB_PROBES][5] PROGMEM = { "DISP", "OUTP", "LCD", "LOOP" };
+
+// input event happened (called from ISRs too), the first one gets measured
+void PRBMark(void)
+{
+  if (!prbMarked) {
+    prbMarkTime = (uint16_t)HALMicros();
+    prbMarked = 1;
+  }
+}
+
+// input event completely handled
+void PRBUnmark(void)
+{
+  prbMarked = 0;
+}
+
+// records time since input event
+void PRBSince(uint8_t probe)
+{
+  if (prbMarked) PRBRecord(probe, prbMarkTime);
+}
+
+// DDS/DAC written, only the first write after an input event is recorded
+void PRBOutput(void)
+{
+  if (prbMarked == 1) {
+    PRBRecord(PRB_OUTPUT, prbMarkTime);
+    prbMarked = 2;
+  }
+}
+
+// records time since start (us), a probe stops counting when count would overflow
+void PRBRecord(uint8_t probe, uint16_t start)
+{
+  uint16_t time = (uint16_t)HALMicros() - start;
+  uint16_t limit = 128;
+  uint8_t  b = 0;
+
+  if (prbStats[probe].count == 0xFFFF) return;
+  if (!prbStats[probe].count || time < prbStats[probe].min) prbStats[probe].min = time;
+  if (time > prbStats[probe].max) prbStats[probe].max = time;
+  prbStats[probe].sum += time;
+  prbStats[probe].count++;
+  for (; time >= limit && b < PRB_BUCKETS - 1; limit <<= 1) b++;
+  prbStats[probe].bucket[b]++;
+}
+
+// one line per probe: name min avg max count bucket0 ... bucket7
+void PRBReport(void)
+{
+  for (uint8_t p = 0; p < PRB_PROBES; p++) {
+    Serial.print((const __FlashStringHelper *)prbNames[p]);
+    Serial.print(' ');
+    Serial.print(prbStats[p].min);
+    Serial.print(' ');
+    Serial.print(prbStats[p].count ? prbStats[p].sum / prbStats[p].count : 0);
+    Serial.print(' ');
+    Serial.print(prbStats[p].max);
+    Serial.print(' ');
+    Serial.print(prbStats[p].count);
+    for (uint8_t b = 0; b < PRB_BUCKETS; b++) {
+      Serial.print(' ');
+      Serial.print(prbStats[p].bucket[b]);
+    }
+    Serial.println();
+  }
+}
+
+void PRBClear(void)
+{
+  memset(prbStats, 0, sizeof(prbStats));
+}
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ * PROBE.H: latency measurement for the AD9833 function generator
+*/
+
+#ifndef PROBE_H_
+#define PROBE_H_
+
+// probes
+#define PRB_DISPATCH  0         // input event (ISR) -> state handler called
+#define PRB_OUTPUT    1         // input event resp. remote command line -> DDS/DAC written
+#define PRB_FLUSH     2         // LCD flush
+#define PRB_LOOP      3         // loop() pass without sleeping
+#define PRB_PROBES    4
+
+#define PRB_BUCKETS   8         // histogram: <128us, <256us, <512us ... <8ms, >=8ms
+
+//
+// function declarations
+//
+void PRBMark(void);
+void PRBUnmark(void);
+void PRBSince(uint8_t probe);
+void PRBOutput(void);
+void PRBRecord(uint8_t probe, uint16_t start);
+void PRBReport(void);
+void PRBClear(void);
+
+// probes compile to nothing without USE_PROBES
+#ifdef USE_PROBES
+#ifndef USE_SERIAL
+#error "USE_PROBES needs USE_SERIAL"
+#endif
+#define PROBE_MARK()            PRBMark()
+#define PROBE_UNMARK()          PRBUnmark()
+#define PROBE_SINCE(probe)      PRBSince(probe)
+#define PROBE_OUTPUT()          PRBOutput()
+#define PROBE_START(start)      uint16_t start = (uint16_t)HALMicros()
+#define PROBE_STOP(probe,start) PRBRecord(probe, start)
+#else
+#define PROBE_MARK()            ((void)0)
+#define PROBE_UNMARK()          ((void)0)
+#define PROBE_SINCE(probe)      ((void)0)
+#define PROBE_OUTPUT()          ((void)0)
+#define PROBE_START(start)
+#define PROBE_STOP(probe,start) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,151 @@
+/*
+ * SWEEP.CPP: timer driven frequency sweep for the AD9833 function generator
+ *
+ * All tuning words get precomputed when a sweep is started (integer only, log law
+ * via fixed point log2/exp2), the timer 1 compare ISR then only pushes the next word
+ * out with one SPI burst. Per step latency is therefore constant and the main loop
+ * is not involved at all.
+*/
+
+#include "config.h"
+#include "hal.h"
+#include "ad9833.h"
+#include "external.h"
+#include "sweep.h"
+
+#ifdef USE_SWEEP
+
+static uint32_t sweepTable[SWEEP_STEPS_MAX];
+static volatile uint8_t sweepSteps = 0;
+static volatile uint8_t sweepIndex = 0;
+
+// 2^(2^-(i+1)) in Q2.30 for fractional bits of exp2
+static const uint32_t exp2Table[16] PROGMEM = {
+  0x5A82799AUL,  0x4C1BF829UL,  0x45CAE0F2UL,  0x42D561B4UL,
+  0x4166C34CUL,  0x40B268FAUL,  0x4058F6A8UL,  0x402C6BE9UL,
+  0x4016321BUL,  0x400B1818UL,  0x40058BCEUL,  0x4002C5D8UL,
+  0x400162E8UL,  0x4000B173UL,  0x400058B9UL,  0x40002C5DUL
+};
+
+// a * b >> 30 for Q2.30 a, b (product < 4.0) with 16x16 bit multiplies only, exact like a
+// 64bit product: a*b = hh*2^32 + (hl+lh)*2^16 + ll, all bits below 2^16 only matter via carry
+static uint32_t SWPMulQ30(uint32_t a, uint32_t b)
+{
+  uint16_t ah = (uint16_t)(a >> 16), al = (uint16_t)a, bh = (uint16_t)(b >> 16), bl = (uint16_t)b;
+  uint32_t hl = (uint32_t)ah * bl, lh = (uint32_t)al * bh;
+  uint32_t mid = (((uint32_t)al * bl) >> 16) + (hl & 0xFFFF) + (lh & 0xFFFF);
+
+  return (((uint32_t)ah * bh + (hl >> 16) + (lh >> 16)) << 2) + (mid >> 14);
+}
+
+// log2(x) for x >= 1 as Q16.16 (integer part via MSB position, fraction via repeated squaring)
+static int32_t SWPLog2(uint32_t x)
+{
+  int32_t result;
+  uint8_t i = 31;
+
+  while (!(x & 0x80000000UL)) {
+    x <<= 1;
+    i--;
+  }
+  result = (int32_t)i << 16;
+  x >>= 1;                                      // x now Q2.30 in range [1,2)
+  for (uint16_t bit = 0x8000; bit; bit >>= 1) {
+    x = SWPMulQ30(x, x);                        // x^2 in range [1,4)
+    if (x & 0x80000000UL) {
+      x >>= 1;
+      result |= bit;
+    }
+  }
+  return result;
+}
+
+// 2^y for Q16.16 y (0 <= y < 30.0), rounded to integer
+static uint32_t SWPExp2(int32_t y)
+{
+  uint32_t x = 0x40000000UL;                    // 1.0 in Q2.30
+  uint8_t  ipart = (uint8_t)(y >> 16);
+  uint16_t frac = (uint16_t)y;
+
+  for (uint8_t i = 0; i < 16; i++) {
+    if (frac & (0x8000 >> i)) {
+      x = SWPMulQ30(x, pgm_read_dword(&exp2Table[i]));
+    }
+  }
+  return (x + (1UL << (29 - ipart))) >> (30 - ipart);
+}
+
+// timer 1 compare handler, one step per dwell time
+static void SWPStep(void)
+{
+  if (sweepIndex >= sweepSteps) sweepIndex = 0;
+  DDSFreqRaw(sweepTable[sweepIndex++]);
+}
+
+// precomputes the tuning words of all steps from startFrequ to stopFrequ (also downwards),
+// returns the number of steps (0: no sweep), must not be called while a sweep is running
+uint8_t SWPTable(uint32_t startFrequ, uint32_t stopFrequ, uint8_t steps, uint8_t law)
+{
+  uint32_t start, stop, diff;
+  uint8_t  i, n;
+
+  if (law == SWEEP_OFF || !startFrequ || !stopFrequ) return 0;
+  steps = (steps < SWEEP_STEPS_MIN) ? SWEEP_STEPS_MIN : ((steps > SWEEP_STEPS_MAX) ? SWEEP_STEPS_MAX : steps);
+  n = steps - 1;
+
+  start = DDSFreqWord(startFrequ);
+  stop = DDSFreqWord(stopFrequ);
+  if (law == SWEEP_LIN) {
+    // start + diff * i / n, split up to avoid 32bit overflow (diff < 2^28)
+    diff = (stop > start) ? stop - start : start - stop;
+    uint32_t q = diff / n, r = diff % n;
+    for (i = 0; i <= n; i++) {
+      uint32_t delta = q * i + ((uint16_t)r * i + n / 2) / n;
+      sweepTable[i] = (stop > start) ? start + delta : start - delta;
+    }
+  }
+  else {
+    // 2^(log2(start) + (log2(stop) - log2(start)) * i / n), equal ratio between steps, log2
+    // needs words >= 1 (below 0.05Hz the word rounds to 0, no frequency for this law)
+    if (!start) start = 1;
+    if (!stop) stop = 1;
+    int32_t logStart = SWPLog2(start), logDiff = SWPLog2(stop) - logStart;
+    for (i = 0; i <= n; i++) {
+      int32_t y = logDiff * i;
+      y = (y < 0) ? -((-y + n / 2) / n) : (y + n / 2) / n;
+      sweepTable[i] = SWPExp2(logStart + y);
+    }
+  }
+  // endpoints exact
+  sweepTable[0] = start;
+  sweepTable[n] = stop;
+  return steps;
+}
+
+// starts the sweep, it runs from startFrequ to stopFrequ (also downwards) and starts over
+// again until SWPStop() gets called
+void SWPStart(uint32_t startFrequ, uint32_t stopFrequ, uint8_t steps, uint16_t dwell, uint8_t law)
+{
+  SWPStop();
+  steps = SWPTable(startFrequ, stopFrequ, steps, law);
+  if (!steps) return;
+  dwell = (dwell < SWEEP_DWELL_MIN) ? SWEEP_DWELL_MIN : ((dwell > SWEEP_DWELL_MAX) ? SWEEP_DWELL_MAX : dwell);
+
+  sweepIndex = 0;
+  sweepSteps = steps;
+  DDSFreqRaw(sweepTable[sweepIndex++]);
+  // timer 1 at 62.5kHz, dwell in ms * 62.5 ticks
+  EXTTimer1Start(SWPStep, T1_PRESCALER_256, (uint16_t)(((uint32_t)dwell * 125) / 2 - 1));
+}
+
+void SWPStop(void)
+{
+  EXTTimer1Stop(SWPStep);
+}
+
+uint8_t SWPRunning(void)
+{
+  return(EXTTimer1Owner(SWPStep));
+}
+
+#endif
@@ -0,0 +1,26 @@
+/*
+ * SWEEP.H: timer driven frequency sweep for the AD9833 function generator
+*/
+
+#ifndef SWEEP_H_
+#define SWEEP_H_
+
+// sweep laws
+#define SWEEP_OFF 0
+#define SWEEP_LIN 1
+#define SWEEP_LOG 2
+
+#define SWEEP_STEPS_MIN 2
+#define SWEEP_STEPS_MAX 32         // table of 28bit tuning words kept in RAM (4 bytes each)
+#define SWEEP_DWELL_MIN 1          // ms
+#define SWEEP_DWELL_MAX 1000       // ms (timer 1 with prescaler 256 allows max. 1048ms)
+
+//
+// function declarations
+//
+uint8_t SWPTable(uint32_t startFrequ, uint32_t stopFrequ, uint8_t steps, uint8_t law);
+void    SWPStart(uint32_t startFrequ, uint32_t stopFrequ, uint8_t steps, uint16_t dwell, uint8_t law);
+void    SWPStop(void);
+uint8_t SWPRunning(void);
+
+#endif
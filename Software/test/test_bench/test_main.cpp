@@ -0,0 +1,107 @@
+/*
+ * TEST_BENCH: host microbenchmarks of the hot paths (native, all options)
+ *
+ * Every function runs against the recording fakes until 50ms have passed, the time per call
+ * is printed as "BM_<name>  <ns> ns  <iterations>". Host times only show relative changes,
+ * they say nothing about the cycles on the Atmega168. Nothing is asserted.
+*/
+
+#include <unity.h>
+#include <stdio.h>
+#include <chrono>
+#include "config.h"
+#include "hal.h"
+#include "ad9833.h"
+#include "external.h"
+
+#define FREQ_RANGE (5000000UL * DDS_HZ)   // MAX_FREQ_TTL of main.cpp
+
+static volatile uint32_t sink;
+static uint32_t          arg;
+
+static void benchmark(const char *name, void (*function)(void))
+{
+  typedef std::chrono::steady_clock clock;
+  uint32_t iterations = 0;
+  char     line[80];
+
+  clock::time_point start = clock::now(), now;
+  do {
+    for (uint16_t i = 0; i < 1000; i++) {
+      HALFakeSpiClear();
+      function();
+      arg++;
+    }
+    iterations += 1000;
+    now = clock::now();
+  } while (now - start < std::chrono::milliseconds(50));
+  snprintf(line, sizeof(line), "BM_%-24s %8.1f ns %10lu", name,
+           std::chrono::duration<double, std::nano>(now - start).count() / iterations, (unsigned long)iterations);
+  TEST_MESSAGE(line);
+}
+
+static void freqWord(void)
+{
+  sink = DDSFreqWord(arg % FREQ_RANGE);
+}
+
+static void freqActual(void)
+{
+  sink = DDSFreqActual(arg % FREQ_RANGE);
+}
+
+static void freq(void)
+{
+  DDSFreq(arg % FREQ_RANGE);
+}
+
+static void dacSetLevel(void)
+{
+  EXTDacSetLevel(arg % (OUTPUT_LEVEL_VPP_MAX + 1), SINUS, arg & 1);
+}
+
+static void displayFrequency(void)
+{
+  EXTDisplayFrequency(arg * 97, 0);
+  sink = EXTDisplayFlush();
+}
+
+static void tick(void)
+{
+  TIMER0_COMPA_vect();
+}
+
+static void loopIdle(void)
+{
+  loop();
+}
+
+void setUp(void)
+{
+  HALFakeReset();
+  DDSInit();
+  EXTDacInit();
+  EXTDisplayClear();
+}
+
+void tearDown(void)
+{
+}
+
+void test_benchmarks(void)
+{
+  benchmark("DDSFreqWord", freqWord);
+  benchmark("DDSFreqActual", freqActual);
+  benchmark("DDSFreq", freq);
+  benchmark("EXTDacSetLevel", dacSetLevel);
+  benchmark("EXTDisplayFrequency+Flush", displayFrequency);
+  benchmark("TIMER0_COMPA_vect", tick);
+  benchmark("loop_idle", loopIdle);
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_benchmarks);
+  return UNITY_END();
+}
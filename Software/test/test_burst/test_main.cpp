@@ -0,0 +1,118 @@
+/*
+ * TEST_BURST: gating of N-cycle bursts (native, all options, 4 AD9833 channels)
+*/
+
+#include <unity.h>
+#include "config.h"
+#include "hal.h"
+#include "ad9833.h"
+#include "external.h"
+#include "burst.h"
+
+// calls the timer 1 compare ISR until a SPI word got written, returns it
+static const halSpiWord *nextWord(void)
+{
+  HALFakeSpiClear();
+  for (uint16_t i = 0; i < 1000 && !halFake.spiCount; i++) TIMER1_COMPA_vect();
+  TEST_ASSERT_EQUAL(1, halFake.spiCount);
+  return(&halFake.spi[0]);
+}
+
+void setUp(void)
+{
+  HALFakeReset();
+  DDSInit();
+  DDSSetup(SINUS, 1000UL * DDS_HZ);
+}
+
+void tearDown(void)
+{
+  BSTStop();
+  DDSClockSet(AD9833_MCLK);
+  DDSChannelSelect(DDS_ALL);
+}
+
+void test_internal_all_channels(void)
+{
+  const halSpiWord *word;
+
+  BSTStart(BURST_INT, 10, 20, 1000UL * DDS_HZ);
+  TEST_ASSERT_TRUE(BSTRunning());
+  word = nextWord();                                        // burst start
+  TEST_ASSERT_EQUAL_HEX8(DDS_ALL, word->select);
+  TEST_ASSERT_EQUAL(0, word->transaction);                  // bare write from the ISR
+  TEST_ASSERT_EQUAL_HEX16(0, word->data & (1 << RESET));
+  word = nextWord();                                        // burst end
+  TEST_ASSERT_EQUAL_HEX8(DDS_ALL, word->select);
+  TEST_ASSERT_EQUAL_HEX16(1 << RESET, word->data & (1 << RESET));
+}
+
+void test_selected_channels(void)
+{
+  DDSChannelSelect(0x06);
+  BSTStart(BURST_INT, 10, 20, 1000UL * DDS_HZ);
+  DDSChannelSelect(DDS_ALL);                                // gating stays with channels 1 & 2
+  TEST_ASSERT_EQUAL_HEX8(0x06, nextWord()->select);
+  TEST_ASSERT_EQUAL_HEX8(0x06, nextWord()->select);
+}
+
+void test_trigger_all_channels(void)
+{
+  BSTStart(BURST_EXT, 10, 20, 1000UL * DDS_HZ);
+  TEST_ASSERT_EQUAL(1, halFake.triggerIrq);
+  HALFakeSpiClear();
+  BSTTrigger();
+  TEST_ASSERT_EQUAL(1, halFake.spiCount);
+  TEST_ASSERT_EQUAL_HEX8(DDS_ALL, halFake.spi[0].select);
+  TEST_ASSERT_EQUAL_HEX16(0, halFake.spi[0].data & (1 << RESET));
+  TEST_ASSERT_EQUAL_HEX16(1 << RESET, nextWord()->data & (1 << RESET));
+}
+
+// burst length in timer 1 ticks: segments from burst start to end
+static uint32_t burstLength(void)
+{
+  uint32_t ticks;
+
+  nextWord();
+  ticks = halFake.timer1.top + 1UL;
+  for (uint16_t i = 0; i < 1000; i++) {
+    HALFakeSpiClear();
+    TIMER1_COMPA_vect();
+    if (halFake.spiCount) break;
+    ticks += halFake.timer1.top + 1UL;
+  }
+  TEST_ASSERT_EQUAL(1, halFake.spiCount);
+  return(ticks);
+}
+
+// 100 periods of the actual frequency, 2MHz ticks, +/-1 tick
+static void checkLength(uint32_t mclk)
+{
+  uint32_t word, expected;
+
+  DDSClockSet(mclk);
+  TEST_ASSERT_EQUAL_UINT32(mclk, DDSClockGet());
+  BSTStart(BURST_INT, 100, 1000, 997UL * DDS_HZ);
+  word = DDSFreqWord(997UL * DDS_HZ);
+  expected = (uint32_t)(100.0 * 268435456.0 / word / mclk * 2e6 + 0.5);
+  TEST_ASSERT_UINT32_WITHIN(1, expected, burstLength());
+  BSTStop();
+}
+
+void test_length_calibrated(void)
+{
+  checkLength(AD9833_MCLK);
+  checkLength(AD9833_MCLK + AD9833_MCLK_TOL);
+  checkLength(AD9833_MCLK - AD9833_MCLK_TOL);
+  checkLength(AD9833_MCLK + 1234);
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_internal_all_channels);
+  RUN_TEST(test_selected_channels);
+  RUN_TEST(test_trigger_all_channels);
+  RUN_TEST(test_length_calibrated);
+  return UNITY_END();
+}
@@ -0,0 +1,180 @@
+/*
+ * TEST_DAC: output level -> AD5452 DAC code and Vpp/Vrms conversion (native, all options)
+*/
+
+#include <unity.h>
+#include <math.h>
+#include <stdio.h>
+#include "config.h"
+#include "hal.h"
+#include "ad9833.h"
+#include "external.h"
+
+// DAC code of the last SPI word (must be a DAC word)
+static uint16_t lastCode(void)
+{
+  TEST_ASSERT_TRUE(halFake.spiCount > 0);
+  const halSpiWord *word = &halFake.spi[halFake.spiCount - 1];
+  TEST_ASSERT_EQUAL_HEX8(HAL_FAKE_DAC, word->select);
+  TEST_ASSERT_EQUAL_HEX16(0, word->data & 0xC003);         // control & unused bits cleared
+  return(word->data >> 2);
+}
+
+// exact reference: round(level * 4095/600 [* 2*sqrt(2) resp. 2*sqrt(3) for Vrms]), limited
+static uint16_t referenceCode(uint16_t level, uint8_t waveform, uint8_t mode)
+{
+  double vpp = (level > OUTPUT_LEVEL_VPP_MAX) ? OUTPUT_LEVEL_VPP_MAX : level;
+  double code;
+
+  if (!mode) vpp *= 2 * sqrt((waveform == SINUS) ? 2.0 : 3.0);
+  code = floor(vpp * 0xFFF / OUTPUT_LEVEL_VPP_MAX + 0.5);
+  return (code > 0xFFF) ? 0xFFF : (uint16_t)code;
+}
+
+// float code EXTDacSetLevel() had before (AVR double = 32bit float): Vrms rounded to 1/100 Vpp
+// first, limited, then truncated to the DAC code
+static uint16_t floatCode(uint16_t level, uint8_t waveform, uint8_t mode)
+{
+  uint16_t temp1 = level;
+
+  if (!mode) temp1 = (uint16_t)(((float)level * 2 * (float)((waveform == SINUS) ? SQRT2 : SQRT3)) + 0.5f);
+  temp1 = (OUTPUT_LEVEL_VPP_MAX < temp1) ? OUTPUT_LEVEL_VPP_MAX : temp1;
+  return (uint16_t)(((float)temp1 / (float)OUTPUT_LEVEL_VPP_MAX) * (float)0xFFF);
+}
+
+void setUp(void)
+{
+  HALFakeReset();
+  EXTDacInit();
+}
+
+void tearDown(void)
+{
+}
+
+void test_level_vpp(void)
+{
+  EXTDacSetLevel(0, SINUS, V_P2P);
+  TEST_ASSERT_EQUAL_UINT16(0, lastCode());
+  EXTDacSetLevel(200, SINUS, V_P2P);
+  TEST_ASSERT_EQUAL_UINT16(1365, lastCode());
+  TEST_ASSERT_EQUAL_UINT16(1365, EXTDacCode());
+  EXTDacSetLevel(OUTPUT_LEVEL_VPP_MAX, TRIANGLE, V_P2P);
+  TEST_ASSERT_EQUAL_UINT16(4095, lastCode());
+  TEST_ASSERT_EQUAL_UINT32(2000000UL, halFake.spiClock);
+}
+
+void test_level_vrms(void)
+{
+  EXTDacSetLevel(100, SINUS, V_RMS);
+  TEST_ASSERT_EQUAL_UINT16(1930, lastCode());
+  EXTDacSetLevel(100, TRIANGLE, V_RMS);
+  TEST_ASSERT_EQUAL_UINT16(2364, lastCode());
+  EXTDacSetLevel(V_RMS_MAX_SIN, SINUS, V_RMS);
+  TEST_ASSERT_EQUAL_UINT16(4092, lastCode());
+  EXTDacSetLevel(V_RMS_MAX_TRI, TRIANGLE, V_RMS);
+  TEST_ASSERT_EQUAL_UINT16(4090, lastCode());
+}
+
+void test_level_limit(void)
+{
+  EXTDacSetLevel(OUTPUT_LEVEL_VPP_MAX + 1, SINUS, V_P2P);
+  TEST_ASSERT_EQUAL_UINT16(4095, lastCode());
+  EXTDacSetLevel(0xFFFF, SINUS, V_RMS);
+  TEST_ASSERT_EQUAL_UINT16(4095, lastCode());
+}
+
+void test_level_conversion(void)
+{
+  TEST_ASSERT_EQUAL_UINT16(283, EXTLevelToVpp(100, SINUS));
+  TEST_ASSERT_EQUAL_UINT16(100, EXTLevelToVrms(283, SINUS));
+  TEST_ASSERT_EQUAL_UINT16(V_RMS_MAX_SIN, EXTLevelToVrms(OUTPUT_LEVEL_VPP_MAX, SINUS));
+  TEST_ASSERT_EQUAL_UINT16(V_RMS_MAX_TRI, EXTLevelToVrms(OUTPUT_LEVEL_VPP_MAX, TRIANGLE));
+}
+
+// every level 0...0xFFFF of Vpp, Vrms sinus & Vrms triangle: DAC code written against the exact
+// reference; the deviation of the former float code is reported for the levels 0...6.00V
+void test_level_exhaustive(void)
+{
+  static const uint8_t cases[3][2] = { { SINUS, V_P2P }, { SINUS, V_RMS }, { TRIANGLE, V_RMS } };
+  uint32_t floatMismatch = 0;
+  int16_t  floatMin = 0, floatMax = 0;
+  char text[100];
+
+  for (uint8_t n = 0; n < 3; n++) {
+    for (uint32_t level = 0; level <= 0xFFFF; level++) {
+      EXTDacSetLevel((uint16_t)level, cases[n][0], cases[n][1]);
+      uint16_t code = lastCode();
+      if (code != referenceCode((uint16_t)level, cases[n][0], cases[n][1])) {
+        snprintf(text, sizeof(text), "case %u level %lu code %u", n, (unsigned long)level, code);
+        TEST_FAIL_MESSAGE(text);
+      }
+      HALFakeSpiClear();
+      if (level > OUTPUT_LEVEL_VPP_MAX) continue;          // the float code overflowed there
+      int16_t diff = (int16_t)(code - floatCode((uint16_t)level, cases[n][0], cases[n][1]));
+      if (diff) floatMismatch++;
+      if (diff < floatMin) floatMin = diff;
+      if (diff > floatMax) floatMax = diff;
+    }
+  }
+  snprintf(text, sizeof(text), "float code: %lu of %lu codes differ, new - old %d...%+d LSB",
+           (unsigned long)floatMismatch, 3 * (OUTPUT_LEVEL_VPP_MAX + 1UL), floatMin, floatMax);
+  TEST_MESSAGE(text);
+  // the float code truncated (new code up to 1 LSB higher) and rounded Vrms to 1/100 Vpp first
+  // (+/-0.005Vpp = +/-3.4 LSB)
+  TEST_ASSERT_TRUE(floatMin >= -3);
+  TEST_ASSERT_TRUE(floatMax <= 4);
+}
+
+// Vpp <-> Vrms for every level 0...6.00V against the same expressions in exact math, and against
+// the float code they replaced (whose SQRT2/SQRT3 have 6 digits only)
+void test_level_conversion_exhaustive(void)
+{
+  static const uint8_t waveforms[2] = { SINUS, TRIANGLE };
+  uint16_t mismatch = 0;
+  char text[80];
+
+  for (uint8_t n = 0; n < 2; n++) {
+    uint8_t waveform = waveforms[n];
+    double  exact = 2 * sqrt((waveform == SINUS) ? 2.0 : 3.0);
+    float   factor = 2 * (float)((waveform == SINUS) ? SQRT2 : SQRT3);
+
+    for (uint16_t level = 0; level <= OUTPUT_LEVEL_VPP_MAX; level++) {
+      uint16_t vrms = EXTLevelToVrms(level, waveform), vpp = EXTLevelToVpp(level, waveform);
+
+      TEST_ASSERT_EQUAL_UINT16((uint16_t)(level / exact), vrms);
+      if (level * exact + 0.8 <= OUTPUT_LEVEL_VPP_MAX) {
+        TEST_ASSERT_EQUAL_UINT16((uint16_t)(level * exact + 0.8), vpp);
+      }
+      if (vrms != (uint16_t)(level / factor)) mismatch++;
+      if ((uint16_t)((level * factor) + 0.8f) <= OUTPUT_LEVEL_VPP_MAX && vpp != (uint16_t)((level * factor) + 0.8f)) {
+        mismatch++;
+        TEST_ASSERT_EQUAL_UINT16((uint16_t)((level * factor) + 0.8f) + 1, vpp);
+      }
+    }
+  }
+  snprintf(text, sizeof(text), "conversions: %u differ from the float code by 1", mismatch);
+  TEST_MESSAGE(text);
+}
+
+void test_refresh(void)
+{
+  EXTDacSetLevel(300, SINUS, V_P2P);
+  HALFakeSpiClear();
+  EXTDacRefresh();
+  TEST_ASSERT_EQUAL(1, halFake.spiCount);
+  TEST_ASSERT_EQUAL_UINT16(EXTDacCode(), lastCode());
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_level_vpp);
+  RUN_TEST(test_level_vrms);
+  RUN_TEST(test_level_limit);
+  RUN_TEST(test_level_conversion);
+  RUN_TEST(test_level_exhaustive);
+  RUN_TEST(test_level_conversion_exhaustive);
+  RUN_TEST(test_refresh);
+  return UNITY_END();
+}
@@ -0,0 +1,274 @@
+/*
+ * TEST_DDS: tuning/phase words and SPI bursts of the AD9833 driver (native, all options)
+*/
+
+#include <unity.h>
+#include <stdio.h>
+#include "config.h"
+#include "hal.h"
+#include "ad9833.h"
+
+#define FREQ_MAX (5000000UL * DDS_HZ)    // highest output frequency of the generator
+
+// exact references: round(f * 2^26 / (25 * MCLK)) and round(word * 25 * MCLK / 2^26), halves up
+static uint32_t referenceWord(uint32_t f, uint32_t clk)
+{
+  uint64_t divisor = (uint64_t)clk * (DDS_HZ / 4);
+
+  return (uint32_t)((((uint64_t)f << 27) / divisor + 1) >> 1);
+}
+
+static uint32_t referenceActual(uint32_t regist, uint32_t clk)
+{
+  uint64_t product = (uint64_t)regist * clk * (DDS_HZ / 4);
+
+  return (uint32_t)((product + (1UL << 25)) >> 26);
+}
+
+// float code the driver had before (AVR double = 32bit float, frequency in Hz, truncated)
+static uint32_t floatWord(uint32_t f)
+{
+  float temp = ((float)f / (float)DDS_HZ) / (float)AD9833_MCLK;
+
+  return (uint32_t)(temp * 268435456.0f);
+}
+
+// 28bit register value of a FREQx LSB/MSB word pair
+static uint32_t freqRegister(uint16_t lsb, uint16_t msb)
+{
+  return (uint32_t)(lsb & 0x3FFF) | ((uint32_t)(msb & 0x3FFF) << 14);
+}
+
+void setUp(void)
+{
+  HALFakeReset();
+  DDSClockSet(AD9833_MCLK);
+  DDSInit();
+  HALFakeSpiClear();
+}
+
+void tearDown(void)
+{
+}
+
+void test_freq_word(void)
+{
+  TEST_ASSERT_EQUAL_UINT32(0, DDSFreqWord(0));
+  TEST_ASSERT_EQUAL_UINT32(1, DDSFreqWord(5));              // 0.05Hz rounds up to 0.093Hz
+  TEST_ASSERT_EQUAL_UINT32(10737, DDSFreqWord(1000UL * DDS_HZ));
+  TEST_ASSERT_EQUAL_UINT32(53687091UL, DDSFreqWord(5000000UL * DDS_HZ));
+}
+
+void test_freq_actual(void)
+{
+  TEST_ASSERT_EQUAL_UINT32(99996, DDSFreqActual(1000UL * DDS_HZ));      // 999.96Hz
+  TEST_ASSERT_EQUAL_UINT32(499999998UL, DDSFreqActual(5000000UL * DDS_HZ));
+  TEST_ASSERT_EQUAL_UINT32(0, DDSFreqActual(0));
+}
+
+// every frequency 0...5MHz in 1/100 Hz steps against the exact reference (quotient & remainder
+// of f * 2^27 / (25 * MCLK) carried from step to step); DDSFreqActual() only depends on the
+// tuning word, so it is checked once for every word reached
+void test_freq_word_exhaustive(void)
+{
+  const uint32_t divisor = AD9833_MCLK * (DDS_HZ / 4);   // > 2^27
+  uint32_t quot = 0, rem = 0, prev = 0xFFFFFFFFUL, floatDiff = 0, floatMismatch = 0;
+  char text[80];
+
+  for (uint32_t f = 0; f <= FREQ_MAX; f++) {
+    uint32_t regist = DDSFreqWord(f);
+
+    if (f) {
+      rem += 1UL << 27;
+      if (rem >= divisor) {
+        rem -= divisor;
+        quot++;
+      }
+    }
+    if (regist != (quot + 1) >> 1) {
+      snprintf(text, sizeof(text), "f=%lu word=%lu", (unsigned long)f, (unsigned long)regist);
+      TEST_FAIL_MESSAGE(text);
+    }
+    if (regist != prev) {
+      if (DDSFreqActual(f) != referenceActual(regist, AD9833_MCLK)) {
+        snprintf(text, sizeof(text), "f=%lu actual=%lu", (unsigned long)f, (unsigned long)DDSFreqActual(f));
+        TEST_FAIL_MESSAGE(text);
+      }
+      prev = regist;
+    }
+    // the former float code (whole Hz only) truncates with a 24bit mantissa
+    if (!(f % DDS_HZ)) {
+      uint32_t old = floatWord(f), diff = (old > regist) ? old - regist : regist - old;
+
+      if (diff) floatMismatch++;
+      if (diff > floatDiff) floatDiff = diff;
+    }
+  }
+  snprintf(text, sizeof(text), "float code: %lu of %lu words differ, max. %lu LSB",
+           (unsigned long)floatMismatch, (unsigned long)(FREQ_MAX / DDS_HZ + 1), (unsigned long)floatDiff);
+  TEST_MESSAGE(text);
+}
+
+// calibrated MCLK at both tolerance limits, every Hz
+void test_freq_word_calibrated(void)
+{
+  static const uint32_t clocks[] = { AD9833_MCLK - AD9833_MCLK_TOL, AD9833_MCLK + AD9833_MCLK_TOL };
+
+  for (uint8_t i = 0; i < 2; i++) {
+    DDSClockSet(clocks[i]);
+    for (uint32_t f = 0; f <= FREQ_MAX; f += DDS_HZ) {
+      uint32_t regist = DDSFreqWord(f);
+
+      TEST_ASSERT_EQUAL_UINT32(referenceWord(f, clocks[i]), regist);
+      TEST_ASSERT_EQUAL_UINT32(referenceActual(regist, clocks[i]), DDSFreqActual(f));
+    }
+  }
+}
+
+void test_calibrated_clock(void)
+{
+  DDSClockSet(AD9833_MCLK + 1000);
+  TEST_ASSERT_EQUAL_UINT32(AD9833_MCLK + 1000, DDSClockGet());
+  TEST_ASSERT_EQUAL_UINT32(1073699UL, DDSFreqWord(100000UL * DDS_HZ));
+  DDSClockSet(AD9833_MCLK * 2);                            // out of range, ignored
+  TEST_ASSERT_EQUAL_UINT32(AD9833_MCLK + 1000, DDSClockGet());
+  // 100kHz counted with nominal MCLK: 1600000 edges in 16s
+  DDSClockSet(AD9833_MCLK);
+  TEST_ASSERT_EQUAL_UINT32(24999996UL, DDSClockMeasured(100000UL * DDS_HZ, 1600000UL));
+  TEST_ASSERT_EQUAL_UINT32(0, DDSClockMeasured(0, 1600000UL));
+}
+
+void test_phase_word(void)
+{
+  TEST_ASSERT_EQUAL_HEX16(0, DDSPhaseWord(0));
+  TEST_ASSERT_EQUAL_HEX16(1024, DDSPhaseWord(90));
+  TEST_ASSERT_EQUAL_HEX16(2048, DDSPhaseWord(180));
+  TEST_ASSERT_EQUAL_HEX16(4085, DDSPhaseWord(359));
+  TEST_ASSERT_EQUAL_HEX16(0, DDSPhaseWord(360));
+}
+
+void test_init_burst(void)
+{
+  HALFakeReset();
+  DDSInit();
+  TEST_ASSERT_EQUAL(4, halFake.spiCount);
+  TEST_ASSERT_EQUAL_HEX16(0x21A2, halFake.spi[0].data);    // RESET, MCLK off, DAC off
+  TEST_ASSERT_EQUAL_HEX16(0x20A2, halFake.spi[1].data);
+  TEST_ASSERT_EQUAL_HEX16(0xC000, halFake.spi[2].data);    // PHASE0 = PHASE1 = 0
+  TEST_ASSERT_EQUAL_HEX16(0xE000, halFake.spi[3].data);
+  for (uint8_t i = 0; i < 4; i++) TEST_ASSERT_EQUAL_HEX8(DDS_ALL, halFake.spi[i].select);
+  TEST_ASSERT_EQUAL_UINT32(4000000UL, halFake.spiClock);
+}
+
+// frequency & waveform in one transaction, idle register FREQ1 loaded first
+void test_setup_burst(void)
+{
+  DDSSetup(SINUS, 1000UL * DDS_HZ);
+  TEST_ASSERT_EQUAL(3, halFake.spiCount);
+  TEST_ASSERT_EQUAL_HEX16(FREQ1_ADDR, halFake.spi[0].data & 0xC000);
+  TEST_ASSERT_EQUAL_UINT32(10737, freqRegister(halFake.spi[0].data, halFake.spi[1].data));
+  TEST_ASSERT_EQUAL_HEX16(0x2800, halFake.spi[2].data);    // B28, FSELECT
+  TEST_ASSERT_EQUAL(halFake.spi[0].transaction, halFake.spi[2].transaction);
+  TEST_ASSERT_TRUE(halFake.spi[0].transaction != 0);
+}
+
+// ping-pong: every retune loads the idle register and toggles FSELECT
+void test_freq_ping_pong(void)
+{
+  DDSSetup(TRIANGLE, 1000UL * DDS_HZ);
+  HALFakeSpiClear();
+  DDSFreq(2000UL * DDS_HZ);
+  TEST_ASSERT_EQUAL(3, halFake.spiCount);
+  TEST_ASSERT_EQUAL_HEX16(FREQ0_ADDR, halFake.spi[0].data & 0xC000);
+  TEST_ASSERT_EQUAL_HEX16(FREQ0_ADDR, halFake.spi[1].data & 0xC000);
+  TEST_ASSERT_EQUAL_UINT32(21475, freqRegister(halFake.spi[0].data, halFake.spi[1].data));
+  TEST_ASSERT_EQUAL_HEX16(0, halFake.spi[2].data & (1 << FSELECT));
+  TEST_ASSERT_EQUAL_HEX16(1 << MODE, halFake.spi[2].data & (1 << MODE));
+  HALFakeSpiClear();
+  DDSFreq(3000UL * DDS_HZ);
+  TEST_ASSERT_EQUAL_HEX16(FREQ1_ADDR, halFake.spi[0].data & 0xC000);
+  TEST_ASSERT_EQUAL_HEX16(1 << FSELECT, halFake.spi[2].data & (1 << FSELECT));
+}
+
+// every word latched by its own FSYNC pulse
+void test_fsync_per_word(void)
+{
+  uint16_t words[3] = { 0x1111, 0x2222, 0x3333 };
+
+  DDSWriteBurst(words, 3);
+  TEST_ASSERT_EQUAL(3, halFake.spiCount);
+  for (uint8_t i = 0; i < 3; i++) TEST_ASSERT_EQUAL_HEX16(words[i], halFake.spi[i].data);
+  TEST_ASSERT_EQUAL_HEX8(0, halFake.select);
+}
+
+void test_channel_select(void)
+{
+  DDSChannelSelect(1 << 1);
+  TEST_ASSERT_EQUAL_HEX8(1 << 1, DDSChannelSelected());
+  DDSSignal(SQUARE);
+  TEST_ASSERT_EQUAL(1, halFake.spiCount);
+  TEST_ASSERT_EQUAL_HEX8(1 << 1, halFake.spi[0].select);
+  DDSChannelSelect(0);                                     // ignored
+  TEST_ASSERT_EQUAL_HEX8(1 << 1, DDSChannelSelected());
+  DDSChannelSelect(DDS_ALL);
+}
+
+// merged channels with another control word adopt the one of the lowest channel first, so
+// the next frequency goes into the inactive register of all of them
+void test_channel_merge(void)
+{
+  uint16_t control;
+
+  DDSSetup(SINUS, 1000UL * DDS_HZ);
+  control = DDSControlGet();
+  DDSChannelSelect(1 << 1);
+  DDSFreq(2000UL * DDS_HZ);                                // channel 1: FSELECT toggled
+  TEST_ASSERT_EQUAL_HEX16(1 << FSELECT, (DDSControlGet() ^ control) & (1 << FSELECT));
+  HALFakeSpiClear();
+  DDSChannelSelect(DDS_ALL);
+  TEST_ASSERT_EQUAL_HEX16(control, DDSControlGet());
+  TEST_ASSERT_EQUAL(1, halFake.spiCount);
+  TEST_ASSERT_EQUAL_HEX8(1 << 1, halFake.spi[0].select);
+  TEST_ASSERT_EQUAL_HEX16(control, halFake.spi[0].data);
+  HALFakeSpiClear();
+  DDSChannelSelect(DDS_ALL);                               // all agree: nothing written
+  TEST_ASSERT_EQUAL(0, halFake.spiCount);
+}
+
+// phase offsets written per channel while the accumulators are held in reset
+void test_sync(void)
+{
+  uint16_t degrees[DDS_CHANNELS] = { 0, 90, 180, 270 };
+
+  DDSSetup(SINUS, 1000UL * DDS_HZ);
+  HALFakeSpiClear();
+  DDSSync(degrees);
+  TEST_ASSERT_EQUAL(2 + DDS_CHANNELS, halFake.spiCount);
+  TEST_ASSERT_EQUAL_HEX16(1 << RESET, halFake.spi[0].data & (1 << RESET));
+  TEST_ASSERT_EQUAL_HEX8(DDS_ALL, halFake.spi[0].select);
+  for (uint8_t ch = 0; ch < DDS_CHANNELS; ch++) {
+    TEST_ASSERT_EQUAL_HEX16(PHASE_ADDR | DDSPhaseWord(degrees[ch]), halFake.spi[1 + ch].data);
+    TEST_ASSERT_EQUAL_HEX8(1 << ch, halFake.spi[1 + ch].select);
+  }
+  TEST_ASSERT_EQUAL_HEX16(0, halFake.spi[1 + DDS_CHANNELS].data & (1 << RESET));
+  TEST_ASSERT_EQUAL_HEX8(DDS_ALL, halFake.spi[1 + DDS_CHANNELS].select);
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_freq_word);
+  RUN_TEST(test_freq_actual);
+  RUN_TEST(test_freq_word_exhaustive);
+  RUN_TEST(test_freq_word_calibrated);
+  RUN_TEST(test_calibrated_clock);
+  RUN_TEST(test_phase_word);
+  RUN_TEST(test_init_burst);
+  RUN_TEST(test_setup_burst);
+  RUN_TEST(test_freq_ping_pong);
+  RUN_TEST(test_fsync_per_word);
+  RUN_TEST(test_channel_select);
+  RUN_TEST(test_channel_merge);
+  RUN_TEST(test_sync);
+  return UNITY_END();
+}
@@ -0,0 +1,129 @@
+/*
+ * TEST_DISPLAY: LCD formatting and the shadow buffer flush (native, all options)
+*/
+
+#include <unity.h>
+#include "config.h"
+#include "hal.h"
+#include "ad9833.h"
+#include "external.h"
+#include "sweep.h"
+
+static char row[17];
+
+static const char *lcdRow(uint8_t r)
+{
+  HALFakeLcdRow(r, row);
+  return(row);
+}
+
+void setUp(void)
+{
+  HALFakeReset();
+  EXTDisplayClear();
+  halFake.lcdBytes = 0;
+}
+
+void tearDown(void)
+{
+}
+
+void test_frequency(void)
+{
+  EXTDisplayFrequency(123456789UL, 0);
+  EXTDisplayFlush();
+  TEST_ASSERT_EQUAL_STRING("    1234567.89Hz", lcdRow(0));
+  EXTDisplayFrequency(1000UL * DDS_HZ, 0);
+  EXTDisplayFlush();
+  TEST_ASSERT_EQUAL_STRING("       1000.00Hz", lcdRow(0));
+  EXTDisplayFrequency(5, 0);                              // leading zeros down to 1Hz digit
+  EXTDisplayFlush();
+  TEST_ASSERT_EQUAL_STRING("          0.05Hz", lcdRow(0));
+}
+
+// digit being edited and all digits below it are shown
+void test_frequency_edit(void)
+{
+  EXTDisplayFrequency(1000UL * DDS_HZ, 100000UL * DDS_HZ);
+  EXTDisplayFlush();
+  TEST_ASSERT_EQUAL_STRING("     001000.00Hz", lcdRow(0));
+}
+
+void test_frequency_limit(void)
+{
+  EXTDisplayFrequency(0xFFFFFFFFUL, 0);
+  EXTDisplayFlush();
+  TEST_ASSERT_EQUAL_STRING("    9999999.99Hz", lcdRow(0));
+}
+
+void test_level(void)
+{
+  EXTDisplayWaveform(SINUS);
+  EXTDisplayLevel(123, V_P2P);
+  EXTDisplayFlush();
+  TEST_ASSERT_EQUAL_STRING("SINUS    1.23Vpp", lcdRow(1));
+  EXTDisplayWaveform(TRIANGLE);
+  EXTDisplayLevel(71, V_RMS);
+  EXTDisplayFlush();
+  TEST_ASSERT_EQUAL_STRING("TRIANGLE 0.71Vrm", lcdRow(1));
+  EXTDisplayWaveform(SQUARE);
+  EXTDisplayFlush();
+  TEST_ASSERT_EQUAL_STRING("SQUARE    5V-TTL", lcdRow(1));
+}
+
+void test_sweep(void)
+{
+  EXTDisplaySweep(SWEEP_LOG, 8, 50, 20000);
+  EXTDisplayFlush();
+  TEST_ASSERT_EQUAL_STRING("Stop  20000.00Hz", lcdRow(0));
+  TEST_ASSERT_EQUAL_STRING("LOG   8x   50ms ", lcdRow(1));
+}
+
+void test_counter(void)
+{
+  EXTDisplayCounter(1000UL * DDS_HZ, 0, AD9833_MCLK + 300);
+  EXTDisplayFlush();
+  TEST_ASSERT_EQUAL_STRING("CNT    1000.00Hz", lcdRow(0));
+  TEST_ASSERT_EQUAL_STRING("MCLK    +12ppm  ", lcdRow(1));
+}
+
+// unchanged cells aren't sent again, a changed cell costs cursor, character & cursor restore
+void test_flush_diff(void)
+{
+  uint16_t sent;
+
+  EXTDisplayFrequency(1000UL * DDS_HZ, 0);
+  EXTDisplayFlush();
+  sent = halFake.lcdBytes;
+  EXTDisplayFrequency(1000UL * DDS_HZ, 0);
+  TEST_ASSERT_EQUAL_UINT16(13, EXTDisplayFlush());        // all 13 rendered bytes saved
+  TEST_ASSERT_EQUAL_UINT16(sent, halFake.lcdBytes);
+  EXTDisplayFrequency(1001UL * DDS_HZ, 0);
+  EXTDisplayFlush();
+  TEST_ASSERT_EQUAL_UINT16(sent + 3, halFake.lcdBytes);
+  TEST_ASSERT_EQUAL_STRING("       1001.00Hz", lcdRow(0));
+}
+
+// the editing cursor gets restored after every flush
+void test_flush_cursor(void)
+{
+  EXTDisplayCursor(12, 1);
+  EXTDisplayLevel(200, V_P2P);
+  EXTDisplayFlush();
+  TEST_ASSERT_EQUAL(12, halFake.lcdCol);
+  TEST_ASSERT_EQUAL(1, halFake.lcdRow);
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_frequency);
+  RUN_TEST(test_frequency_edit);
+  RUN_TEST(test_frequency_limit);
+  RUN_TEST(test_level);
+  RUN_TEST(test_sweep);
+  RUN_TEST(test_counter);
+  RUN_TEST(test_flush_diff);
+  RUN_TEST(test_flush_cursor);
+  return UNITY_END();
+}
@@ -0,0 +1,171 @@
+/*
+ * TEST_PERSIST: wear levelled record log and preset slots in EEPROM (native, all options)
+*/
+
+#include <unity.h>
+#include "config.h"
+#include "hal.h"
+#include "ad9833.h"
+#include "external.h"
+#include "persist.h"
+
+extern uint8_t   eLog[PER_RECORDS][PER_RECORD_SIZE];
+extern perPreset ePreset[PER_PRESETS];
+extern perPresetExt ePresetExt[PER_PRESETS];
+
+// EEPROM ready interrupts until the record is complete
+static void storeComplete(const perSettings *settings)
+{
+  PERStore(settings);
+  for (uint8_t i = 0; halFake.eepromIrq && i < PER_RECORD_SIZE + 1; i++) EE_READY_vect();
+  TEST_ASSERT_FALSE(PERBusy());
+}
+
+static perSettings makeSettings(uint32_t frequency)
+{
+  perSettings settings;
+
+  memset(&settings, 0, sizeof(settings));
+  settings.waveform = SINUS;
+  settings.levelMode = V_P2P;
+  settings.level = 150;
+  settings.frequency = frequency;
+  return(settings);
+}
+
+void setUp(void)
+{
+  perSettings settings;
+
+  HALFakeReset();
+  PERLoad(&settings);
+}
+
+void tearDown(void)
+{
+}
+
+void test_empty(void)
+{
+  perSettings settings;
+
+  TEST_ASSERT_EQUAL(0, PERLoad(&settings));
+}
+
+void test_store_load(void)
+{
+  perSettings stored = makeSettings(123456), loaded;
+
+  storeComplete(&stored);
+  TEST_ASSERT_EQUAL(1, PERLoad(&loaded));
+  TEST_ASSERT_EQUAL_MEMORY(&stored, &loaded, sizeof(perSettings));
+}
+
+// the ring wraps around, the highest sequence number (modulo 256) wins
+void test_ring(void)
+{
+  perSettings settings, loaded;
+
+  for (uint16_t i = 0; i < 3 * PER_RECORDS + 5; i++) {
+    settings = makeSettings(1000 + i);
+    storeComplete(&settings);
+  }
+  TEST_ASSERT_EQUAL(1, PERLoad(&loaded));
+  TEST_ASSERT_EQUAL_UINT32(settings.frequency, loaded.frequency);
+}
+
+// unchanged bytes of a slot are not written again
+void test_write_count(void)
+{
+  perSettings settings = makeSettings(5000);
+
+  storeComplete(&settings);
+  TEST_ASSERT_EQUAL(PER_RECORD_SIZE, halFake.eepromWrites);
+}
+
+// a record torn by power loss fails the CRC, the previous one stays valid
+void test_torn_record(void)
+{
+  perSettings first = makeSettings(1111), second = makeSettings(2222), loaded;
+
+  storeComplete(&first);
+  PERStore(&second);
+  for (uint8_t i = 0; i < 4; i++) EE_READY_vect();
+  HALEepromIrq(0);                                          // power lost
+  TEST_ASSERT_EQUAL(1, PERLoad(&loaded));
+  TEST_ASSERT_EQUAL_UINT32(1111, loaded.frequency);
+}
+
+// records of former firmware (frequency in Hz, other CRC seed) get converted
+void test_former_record(void)
+{
+  perSettings settings = makeSettings(1000), loaded;
+  uint8_t crc = PER_SEED_HZ;
+
+  eLog[3][0] = 7;
+  memcpy(&eLog[3][1], &settings, sizeof(settings));
+  for (uint8_t i = 0; i < PER_RECORD_SIZE - 1; i++) crc = HALCrc8(crc, eLog[3][i]);
+  eLog[3][PER_RECORD_SIZE - 1] = crc;
+  TEST_ASSERT_EQUAL(1, PERLoad(&loaded));
+  TEST_ASSERT_EQUAL_UINT32(1000UL * DDS_HZ, loaded.frequency);
+}
+
+void test_preset(void)
+{
+  perPreset preset, loaded;
+  uint8_t   centiHz = 0xFF;
+
+  memset(&preset, 0, sizeof(preset));
+  preset.frequency = 440;
+  preset.waveform = TRIANGLE;
+  preset.level = 300;
+  preset.modBaud = 1200;
+  TEST_ASSERT_EQUAL(0, PERPresetLoad(2, &loaded, &centiHz));
+  PERPresetSave(2, &preset, 25);
+  TEST_ASSERT_EQUAL(1, PERPresetLoad(2, &loaded, &centiHz));
+  TEST_ASSERT_EQUAL_MEMORY(&preset, &loaded, sizeof(perPreset));
+  TEST_ASSERT_EQUAL(25, centiHz);
+  ((uint8_t *)&ePreset[2])[1] ^= 0x10;                      // corrupted
+  TEST_ASSERT_EQUAL(0, PERPresetLoad(2, &loaded, &centiHz));
+  TEST_ASSERT_EQUAL(0, PERPresetLoad(PER_PRESETS, &loaded, &centiHz));
+}
+
+// presets of former firmware (no 1/100 Hz beside them) stay valid with 0 as 1/100 Hz, also if
+// they get saved again by former firmware over a preset with 1/100 Hz
+void test_former_preset(void)
+{
+  perPreset preset, loaded;
+  uint8_t   centiHz = 0xFF;
+
+  memset(&preset, 0, sizeof(preset));
+  preset.frequency = 1000;
+  preset.waveform = SINUS;
+  PERPresetSave(4, &preset, 50);
+  memset(&ePresetExt[4], 0xFF, sizeof(perPresetExt));     // erased
+  TEST_ASSERT_EQUAL(1, PERPresetLoad(4, &loaded, &centiHz));
+  TEST_ASSERT_EQUAL_UINT32(1000, loaded.frequency);
+  TEST_ASSERT_EQUAL(0, centiHz);
+
+  PERPresetSave(4, &preset, 50);
+  perPresetExt ext = ePresetExt[4];
+  preset.frequency = 2000;
+  PERPresetSave(4, &preset, 0);
+  ePresetExt[4] = ext;                                      // preset written without 1/100 Hz
+  TEST_ASSERT_EQUAL(1, PERPresetLoad(4, &loaded, &centiHz));
+  TEST_ASSERT_EQUAL_UINT32(2000, loaded.frequency);
+  TEST_ASSERT_EQUAL(0, centiHz);
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_empty);
+  RUN_TEST(test_store_load);
+  RUN_TEST(test_ring);
+  RUN_TEST(test_write_count);
+  RUN_TEST(test_torn_record);
+  RUN_TEST(test_former_record);
+  RUN_TEST(test_preset);
+  RUN_TEST(test_former_preset);
+  return UNITY_END();
+}
@@ -0,0 +1,99 @@
+/*
+ * TEST_SWEEP: precomputed tuning words of linear & logarithmic sweeps (native, all options)
+*/
+
+#include <unity.h>
+#include <math.h>
+#include "config.h"
+#include "hal.h"
+#include "ad9833.h"
+#include "external.h"
+#include "sweep.h"
+
+// tuning words of all steps of the running sweep: the first one written by SWPStart(), the
+// others by the timer 1 compare ISR (DDSFreqRaw(): FREQx LSB, MSB, control word)
+static void sweepWords(uint32_t *words, uint8_t steps)
+{
+  for (uint8_t i = 0; i < steps; i++) {
+    if (i) {
+      HALFakeSpiClear();
+      TIMER1_COMPA_vect();
+    }
+    TEST_ASSERT_EQUAL(3, halFake.spiCount);
+    words[i] = (uint32_t)(halFake.spi[0].data & 0x3FFF) | ((uint32_t)(halFake.spi[1].data & 0x3FFF) << 14);
+  }
+}
+
+// log sweep against 2^(log2(start) + (log2(stop) - log2(start)) * i / n) in double (words >= 1),
+// the Q16.16 logarithm allows 2^-16 (1.06e-5) relative error
+static void checkLog(uint32_t startFrequ, uint32_t stopFrequ, uint8_t steps)
+{
+  uint32_t words[SWEEP_STEPS_MAX];
+  double   start = DDSFreqWord(startFrequ), stop = DDSFreqWord(stopFrequ);
+
+  if (start < 1) start = 1;
+  if (stop < 1) stop = 1;
+
+  HALFakeSpiClear();
+  SWPStart(startFrequ, stopFrequ, steps, SWEEP_DWELL_MIN, SWEEP_LOG);
+  TEST_ASSERT_TRUE(SWPRunning());
+  sweepWords(words, steps);
+  for (uint8_t i = 0; i < steps; i++) {
+    double expected = exp2(log2(start) + (log2(stop) - log2(start)) * i / (steps - 1));
+    TEST_ASSERT_UINT32_WITHIN((uint32_t)(expected * 1.1e-5) + 1, (uint32_t)lround(expected), words[i]);
+  }
+  TEST_ASSERT_EQUAL_UINT32((uint32_t)start, words[0]);
+  TEST_ASSERT_EQUAL_UINT32((uint32_t)stop, words[steps - 1]);
+}
+
+void setUp(void)
+{
+  HALFakeReset();
+  DDSInit();
+}
+
+void tearDown(void)
+{
+  SWPStop();
+}
+
+void test_log(void)
+{
+  checkLog(1000UL * DDS_HZ, 100000UL * DDS_HZ, SWEEP_STEPS_MAX);
+  checkLog(20UL * DDS_HZ, 5000000UL * DDS_HZ, 17);
+  checkLog(100000UL * DDS_HZ, 10UL * DDS_HZ, SWEEP_STEPS_MIN);     // downwards
+}
+
+// start/stop below 0.05Hz: tuning word 0, log2(0) used to loop forever
+void test_log_word_zero(void)
+{
+  uint32_t words[8];
+
+  HALFakeSpiClear();
+  SWPStart(1, 4, 8, SWEEP_DWELL_MIN, SWEEP_LOG);
+  TEST_ASSERT_TRUE(SWPRunning());
+  sweepWords(words, 8);
+  for (uint8_t i = 0; i < 8; i++) TEST_ASSERT_EQUAL_UINT32(1, words[i]);
+  checkLog(3, 1000UL * DDS_HZ, 10);
+}
+
+void test_lin(void)
+{
+  uint32_t words[5];
+
+  HALFakeSpiClear();
+  SWPStart(1, 400UL * DDS_HZ, 5, SWEEP_DWELL_MIN, SWEEP_LIN);      // 0.01Hz: word 0
+  sweepWords(words, 5);
+  TEST_ASSERT_EQUAL_UINT32(0, words[0]);
+  TEST_ASSERT_EQUAL_UINT32(DDSFreqWord(400UL * DDS_HZ), words[4]);
+  TEST_ASSERT_UINT32_WITHIN(1, DDSFreqWord(200UL * DDS_HZ), words[2]);
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_log);
+  RUN_TEST(test_log_word_zero);
+  RUN_TEST(test_lin);
+  return UNITY_END();
+}
@@ -0,0 +1,259 @@
+/*
+ * TEST_UI: user interface state machine & remote control driven through the input ISRs
+ *          (native, all options, main.cpp with setup() & loop())
+*/
+
+#include <unity.h>
+#include "config.h"
+#include "hal.h"
+#include "ad9833.h"
+#include "external.h"
+#include "persist.h"
+
+// main.cpp
+#define M_IDLE     0
+#define M_WAVEFORM 1
+#define M_LEVEL    2
+#define M_FREQUENCY1 3
+extern uint8_t  systemState;
+extern uint8_t  outputWaveform;
+extern uint16_t outputLevel;
+extern uint8_t  outputLevelMode;
+extern uint32_t outputFrequency;
+
+static char row[17];
+
+static const char *lcdRow(uint8_t r)
+{
+  HALFakeLcdRow(r, row);
+  return(row);
+}
+
+// 1ms ticks (timer 0 compare ISR), an EEPROM byte gets written every tick
+static void tick(uint16_t ms)
+{
+  while (ms--) {
+    TIMER0_COMPA_vect();
+    if (halFake.eepromIrq) EE_READY_vect();
+    halFake.micros += 1024;
+  }
+}
+
+// button pressed for ms, released & debounced, events handled
+static void press(uint8_t button, uint16_t ms)
+{
+  halFake.inputs &= ~button;
+  tick(ms);
+  halFake.inputs |= button;
+  tick(10);
+  loop();
+}
+
+// one encoder detent (slow, no acceleration): BA 11 -> 01 -> 00 -> 10 -> 11 is a right turn
+static void turn(int8_t dir)
+{
+  static const uint8_t right[4] = { 1, 0, 2, 3 }, left[4] = { 2, 0, 1, 3 };
+
+  for (uint8_t i = 0; i < 4; i++) {
+    uint8_t ba = (dir > 0) ? right[i] : left[i];
+    halFake.inputs = (halFake.inputs & ~(HAL_ENCODER_A | HAL_ENCODER_B)) | (uint8_t)(ba << HAL_ENCODER_SHIFT);
+    PCINT2_vect();
+  }
+  tick(100);
+  loop();
+}
+
+// remote command line, answer in halFake.serialOut
+static void remote(const char *line)
+{
+  HALFakeSerialClear();
+  halFake.serialIn = line;
+  loop();
+}
+
+// last SPI word written to any AD9833 channel resp. the DAC
+static uint16_t lastWord(uint8_t dac)
+{
+  for (uint16_t i = halFake.spiCount; i--; ) {
+    if (!(halFake.spi[i].select & HAL_FAKE_DAC) != !dac) continue;
+    return(halFake.spi[i].data);
+  }
+  TEST_FAIL_MESSAGE("no SPI word");
+  return(0);
+}
+
+void setUp(void)
+{
+  PERFlush();                                   // record of previous test
+  HALFakeReset();
+  systemState = M_IDLE;
+  setup();
+}
+
+void tearDown(void)
+{
+}
+
+// first start with erased EEPROM: defaults 1kHz sinus 2.00Vpp
+void test_power_on(void)
+{
+  TEST_ASSERT_EQUAL_STRING("        999.96Hz", lcdRow(0));
+  TEST_ASSERT_EQUAL_STRING("SINUS    2.00Vpp", lcdRow(1));
+  TEST_ASSERT_EQUAL_HEX16(DAC_WORD(1365), lastWord(1));
+  TEST_ASSERT_EQUAL_HEX16(0, lastWord(0) & ((1 << RESET) | (1 << SLEEP1) | (1 << MODE) | (1 << OPBITEN)));
+  TEST_ASSERT_EQUAL(0, halFake.relais);
+  TEST_ASSERT_EQUAL(1, halFake.watchdog);
+  TEST_ASSERT_TRUE(strstr(halFake.serialOut, "Programmstart ok.") != 0);
+}
+
+// select switch steps through waveform, level & frequency
+void test_select_states(void)
+{
+  press(HAL_BUTTON_SELECT, 20);
+  TEST_ASSERT_EQUAL(M_WAVEFORM, systemState);
+  TEST_ASSERT_EQUAL(1, halFake.lcdBlink);
+  press(HAL_BUTTON_SELECT, 20);
+  TEST_ASSERT_EQUAL(M_LEVEL, systemState);
+  press(HAL_BUTTON_SELECT, 20);
+  TEST_ASSERT_EQUAL(M_FREQUENCY1, systemState);
+  TEST_ASSERT_EQUAL(1, halFake.lcdCursor);
+}
+
+// waveform gets applied at once (no explicit confirmation), relais for square
+void test_waveform(void)
+{
+  press(HAL_BUTTON_SELECT, 20);
+  turn(1);
+  TEST_ASSERT_EQUAL(TRIANGLE, outputWaveform);
+  TEST_ASSERT_EQUAL_STRING("TRIANGLE 2.00Vpp", lcdRow(1));
+  TEST_ASSERT_EQUAL_HEX16(1 << MODE, lastWord(0) & (1 << MODE));
+  turn(1);
+  TEST_ASSERT_EQUAL(SQUARE, outputWaveform);
+  TEST_ASSERT_EQUAL_STRING("SQUARE    5V-TTL", lcdRow(1));
+  TEST_ASSERT_EQUAL(1, halFake.relais);
+}
+
+void test_level(void)
+{
+  press(HAL_BUTTON_SELECT, 20);
+  press(HAL_BUTTON_SELECT, 20);
+  turn(1);
+  TEST_ASSERT_EQUAL_UINT16(201, outputLevel);
+  TEST_ASSERT_EQUAL_STRING("SINUS    2.01Vpp", lcdRow(1));
+  TEST_ASSERT_EQUAL_HEX16(DAC_WORD(1372), lastWord(1));
+  turn(-1);
+  turn(-1);
+  TEST_ASSERT_EQUAL_UINT16(199, outputLevel);
+}
+
+// long press in level mode toggles Vpp/Vrms, the output stays the same
+void test_level_mode(void)
+{
+  press(HAL_BUTTON_SELECT, 20);
+  press(HAL_BUTTON_SELECT, 20);
+  press(HAL_BUTTON_ENCODER, 600);
+  TEST_ASSERT_EQUAL_STRING("SINUS    0.70Vrm", lcdRow(1));
+  TEST_ASSERT_EQUAL_UINT16(70, outputLevel);
+}
+
+// state falls back to idle after MAX_IDLE_TIME without input
+void test_idle_timeout(void)
+{
+  press(HAL_BUTTON_SELECT, 20);
+  TEST_ASSERT_EQUAL(M_WAVEFORM, systemState);
+  tick(29297 - 1);                                          // 30s in ticks of 1.024ms
+  loop();
+  TEST_ASSERT_EQUAL(M_WAVEFORM, systemState);
+  tick(1);
+  loop();
+  TEST_ASSERT_EQUAL(M_IDLE, systemState);
+  TEST_ASSERT_EQUAL(0, halFake.lcdCursor);
+}
+
+// one command line gets activated as one transaction
+void test_remote(void)
+{
+  remote("freq 1234.5;VOLT 3\n");
+  TEST_ASSERT_EQUAL_STRING("", halFake.serialOut);
+  TEST_ASSERT_EQUAL_UINT32(123450UL, outputFrequency);
+  TEST_ASSERT_EQUAL_STRING("       1234.47Hz", lcdRow(0));
+  TEST_ASSERT_EQUAL_STRING("SINUS    3.00Vpp", lcdRow(1));
+  TEST_ASSERT_EQUAL_HEX16(DAC_WORD(2048), lastWord(1));
+  remote("FREQ?\n");
+  TEST_ASSERT_EQUAL_STRING("1234.50\r\n", halFake.serialOut);
+  remote("VOLT 7\n");
+  TEST_ASSERT_EQUAL_STRING("ERR\r\n", halFake.serialOut);
+  TEST_ASSERT_EQUAL_UINT16(300, outputLevel);
+}
+
+// VOLT:UNIT is staged with the line: VOLT gets checked in the new unit, an invalid line changes
+// nothing, a unit change alone converts the level
+void test_remote_unit(void)
+{
+  remote("VOLT:UNIT VRMS;VOLT 2.5\n");                       // 2.50Vpp ok, 2.50Vrms too high
+  TEST_ASSERT_EQUAL_STRING("ERR\r\n", halFake.serialOut);
+  TEST_ASSERT_EQUAL(V_P2P, outputLevelMode);
+  remote("VOLT:UNIT VRMS;FREQ 9000000\n");
+  TEST_ASSERT_EQUAL_STRING("ERR\r\n", halFake.serialOut);
+  TEST_ASSERT_EQUAL(V_P2P, outputLevelMode);
+  remote("VOLT:UNIT VRMS;VOLT 1.5\n");
+  TEST_ASSERT_EQUAL_STRING("", halFake.serialOut);
+  TEST_ASSERT_EQUAL(V_RMS, outputLevelMode);
+  TEST_ASSERT_EQUAL_UINT16(150, outputLevel);
+  TEST_ASSERT_EQUAL_STRING("SINUS    1.50Vrm", lcdRow(1));
+  remote("VOLT:UNIT VPP\n");
+  TEST_ASSERT_EQUAL(V_P2P, outputLevelMode);
+  TEST_ASSERT_EQUAL_UINT16(EXTLevelToVpp(150, SINUS), outputLevel);
+  remote("VOLT 5;VOLT:UNIT VRMS\n");                         // 5.00Vpp -> 1.76Vrms
+  TEST_ASSERT_EQUAL(V_RMS, outputLevelMode);
+  TEST_ASSERT_EQUAL_UINT16(EXTLevelToVrms(500, SINUS), outputLevel);
+}
+
+// a line with an invalid command has no effect at all, not even by the commands before it
+void test_remote_invalid_line(void)
+{
+  remote("OUTP OFF;FUNC XYZ\n");
+  TEST_ASSERT_EQUAL_STRING("ERR\r\n", halFake.serialOut);
+  remote("OUTP?\n");
+  TEST_ASSERT_EQUAL_STRING("1\r\n", halFake.serialOut);
+  remote("*SAV 1;VOLT 99\n");
+  TEST_ASSERT_EQUAL_STRING("ERR\r\n", halFake.serialOut);
+  remote("*RCL 1\n");
+  TEST_ASSERT_EQUAL_STRING("ERR\r\n", halFake.serialOut);
+  remote("FREQ?;OUTP OFF\n");
+  TEST_ASSERT_EQUAL_STRING("1000.00\r\n", halFake.serialOut);
+  remote("OUTP?\n");
+  TEST_ASSERT_EQUAL_STRING("0\r\n", halFake.serialOut);
+  remote("OUTP ON\n");
+}
+
+// settings get stored after PERSIST_DELAY without changes and survive a restart
+void test_persist(void)
+{
+  remote("FUNC TRI;FREQ 440\n");
+  tick(PERSIST_DELAY + 10);
+  loop();
+  tick(PER_RECORD_SIZE);
+  TEST_ASSERT_FALSE(PERBusy());
+  outputWaveform = SINUS;
+  outputFrequency = 0;
+  setup();
+  TEST_ASSERT_EQUAL(TRIANGLE, outputWaveform);
+  TEST_ASSERT_EQUAL_UINT32(440UL * DDS_HZ, outputFrequency);
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_power_on);
+  RUN_TEST(test_select_states);
+  RUN_TEST(test_waveform);
+  RUN_TEST(test_level);
+  RUN_TEST(test_level_mode);
+  RUN_TEST(test_idle_timeout);
+  RUN_TEST(test_remote);
+  RUN_TEST(test_remote_unit);
+  RUN_TEST(test_remote_invalid_line);
+  RUN_TEST(test_persist);
+  return UNITY_END();
+}